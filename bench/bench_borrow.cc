@@ -0,0 +1,157 @@
+// ns/op and hardware counters/op of the RefCell operations: borrow_const,
+// borrow_mut and the Ref/RefMut destructors, each in its own loop, plus
+// borrow_const/~Ref on one cell shared by several threads (where the
+// counter's cache line moves between cores; see BORROW_PERF_HITM in
+// perf_counters.h). Without perf counters only the timings are printed.
+//
+// g++ -std=c++11 -O2 -pthread -DNDEBUG -I.. bench_borrow.cc ../borrow_diag.cc -o bench_borrow && ./bench_borrow [threads]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+#include "../borrow.h"
+#include "perf_counters.h"
+using namespace borrow;
+
+static const int kCells = 1024;
+static const int kRounds = 2000;
+static const int kSharedIters = 1000000;
+
+static double now_ns() {
+  return std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result {
+  double ns;
+  double ops;
+  PerfCounters::Sample counters;
+};
+
+static void print(const char* name, const Result& r) {
+  printf("%-28s %8.2f", name, r.ns / r.ops);
+  for (int e = 0; e < PerfCounters::kEvents; e++) {
+    if (r.counters.valid[e]) {
+      printf(" %10.3f", r.counters.v[e] / r.ops);
+    } else {
+      printf(" %10s", "-");
+    }
+  }
+  printf("\n");
+}
+
+// Guards are constructed into and destroyed from raw storage, so the two
+// halves of a borrow are measured on their own.
+template <class Guard, class Borrow>
+static void run_pair(const char* borrow_name, const char* drop_name, Borrow borrow) {
+  std::vector<RefCell<int>> cells;
+  cells.reserve(kCells);
+  for (int i = 0; i < kCells; i++) {
+    cells.emplace_back(new int(i));
+  }
+  std::vector<typename std::aligned_storage<sizeof(Guard), alignof(Guard)>::type> slots(kCells);
+  Guard* guards = reinterpret_cast<Guard*>(slots.data());
+  int* raws[kCells];
+  for (int i = 0; i < kCells; i++) {
+    raws[i] = cells[i].raw_;
+  }
+
+  PerfCounters pc;
+  Result acquire = {0, 0.0 + kCells * kRounds, {}};
+  Result release = acquire;
+  PerfCounters::Sample sum_acquire = {};
+  PerfCounters::Sample sum_release = {};
+  for (int round = 0; round < kRounds; round++) {
+    // the ioctls of start()/stop() stay outside the timed part
+    pc.start();
+    double t0 = now_ns();
+    for (int i = 0; i < kCells; i++) {
+      new (&guards[i]) Guard(borrow(cells[i]));
+    }
+    double t1 = now_ns();
+    PerfCounters::Sample a = pc.stop();
+    pc.start();
+    double t2 = now_ns();
+    for (int i = 0; i < kCells; i++) {
+      guards[i].~Guard();
+    }
+    double t3 = now_ns();
+    PerfCounters::Sample r = pc.stop();
+    acquire.ns += t1 - t0;
+    release.ns += t3 - t2;
+    for (int e = 0; e < PerfCounters::kEvents; e++) {
+      sum_acquire.v[e] += a.v[e];
+      sum_acquire.valid[e] = a.valid[e];
+      sum_release.v[e] += r.v[e];
+      sum_release.valid[e] = r.valid[e];
+    }
+    // RefCell::borrow_mut clears the cell's pointer
+    for (int i = 0; i < kCells; i++) {
+      cells[i].raw_ = raws[i];
+    }
+  }
+  acquire.counters = sum_acquire;
+  release.counters = sum_release;
+  print(borrow_name, acquire);
+  print(drop_name, release);
+}
+
+static void run_shared(int threads) {
+  RefCell<int> cell(new int(1));
+  std::vector<Result> results(threads);
+  std::vector<std::thread> ts;
+  for (int t = 0; t < threads; t++) {
+    ts.emplace_back([&cell, &results, t] {
+      PerfCounters pc;
+      pc.start();
+      double t0 = now_ns();
+      for (int i = 0; i < kSharedIters; i++) {
+        Ref<int> r = cell.borrow_const();
+        asm volatile("" : : "r"(r.raw_) : "memory");
+      }
+      results[t].ns = now_ns() - t0;
+      results[t].counters = pc.stop();
+      results[t].ops = kSharedIters;
+    });
+  }
+  for (auto& t : ts) {
+    t.join();
+  }
+  Result total = {0, 0, {}};
+  for (auto& r : results) {
+    total.ns += r.ns;
+    total.ops += r.ops;
+    for (int e = 0; e < PerfCounters::kEvents; e++) {
+      total.counters.v[e] += r.counters.v[e];
+      total.counters.valid[e] = r.counters.valid[e];
+    }
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "borrow_const+~Ref, %d thr", threads);
+  print(name, total);
+}
+
+int main(int argc, char** argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+  {
+    PerfCounters pc;
+    if (!pc.available()) {
+      printf("perf counters unavailable (%s), timing only\n", strerror(pc.error()));
+    }
+  }
+  printf("%-28s %8s", "", "ns/op");
+  for (int e = 0; e < PerfCounters::kEvents; e++) {
+    printf(" %10s", PerfCounters::name(e));
+  }
+  printf("\n");
+  run_pair<Ref<int>>("RefCell::borrow_const", "~Ref", [](RefCell<int>& c) { return c.borrow_const(); });
+  run_pair<RefMut<int>>("RefCell::borrow_mut", "~RefMut", [](RefCell<int>& c) { return c.borrow_mut(); });
+  run_shared(1);
+  if (threads > 1) {
+    run_shared(threads);
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+// Copy-into-one-buffer vs. IovecBatch::writev, writing into a local pipe
+// that a second thread drains.
+//
+// g++ -std=c++11 -O2 -pthread -I.. bench_iovec.cc ../borrow_diag.cc -o bench_iovec && ./bench_iovec
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "../borrow_iovec.h"
+using namespace borrow;
+
+static const int kParts = 8;
+static const int kIters = 20000;
+
+static double now_ns() {
+  return std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void write_full(int fd, const char* p, size_t len) {
+  while (len > 0) {
+    ssize_t r = write(fd, p, len);
+    if (r <= 0) {
+      perror("write");
+      exit(1);
+    }
+    p += r;
+    len -= r;
+  }
+}
+
+int main() {
+  for (size_t part_size : {64, 1024, 16384}) {
+    std::vector<RefCell<std::string>> parts;
+    parts.reserve(kParts);
+    for (int i = 0; i < kParts; i++) {
+      parts.emplace_back(new std::string(part_size, 'a' + i));
+    }
+    int fds[2];
+    if (pipe(fds) != 0) {
+      perror("pipe");
+      return 1;
+    }
+    int fd = fds[0];
+    std::thread drain([fd] {
+      char buf[1 << 16];
+      while (read(fd, buf, sizeof(buf)) > 0) {
+      }
+    });
+
+    std::string out;
+    double t0 = now_ns();
+    for (int it = 0; it < kIters; it++) {
+      out.clear();
+      for (auto& c : parts) {
+        auto r = c.borrow_const();
+        out.append(*r);
+      }
+      write_full(fds[1], out.data(), out.size());
+    }
+    double copy_ns = (now_ns() - t0) / kIters;
+
+    t0 = now_ns();
+    for (int it = 0; it < kIters; it++) {
+      IovecBatch<kParts> batch;
+      for (auto& c : parts) {
+        batch.add(c.borrow_const());
+      }
+      if (batch.writev(fds[1]) < 0) {
+        perror("writev");
+        return 1;
+      }
+    }
+    double iov_ns = (now_ns() - t0) / kIters;
+
+    close(fds[1]);
+    drain.join();
+    close(fds[0]);
+    printf("%2d x %6zu bytes: copy+write %9.1f ns/op, writev %9.1f ns/op\n",
+           kParts, part_size, copy_ns, iov_ns);
+  }
+  return 0;
+}
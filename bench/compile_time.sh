@@ -0,0 +1,58 @@
+#!/bin/bash
+# Per-TU cost of including borrow.h, before and after a change: preprocessed
+# lines, -fsyntax-only and -O2 -c wall time (best of N runs) of a small TU
+# that uses RefCell, and the static initializers the object file gets.
+#
+# ./compile_time.sh [before-rev] [runs]
+#
+# before-rev defaults to the commit before borrow_diag.cc was added (the
+# split of the failure path out of borrow.h); the after side is the work
+# tree. CXX and CXXFLAGS are honoured.
+set -e
+cd "$(dirname "$0")/.."
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++11}
+BEFORE=${1:-$(git log --diff-filter=A --format=%h -1 -- borrow_diag.cc)~1}
+RUNS=${2:-20}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/before"
+git archive "$BEFORE" | tar -x -C "$tmp/before"
+
+cat > "$tmp/tu.cc" <<'EOF'
+#include "borrow.h"
+int use_borrow(borrow::RefCell<int>& cell) {
+  borrow::Ref<int> r = borrow::borrow_const(cell);
+  return *r;
+}
+EOF
+
+# best wall time in ms of running "$@" RUNS times
+best_ms() {
+  local best=
+  for ((i = 0; i < RUNS; i++)); do
+    local t0=$(date +%s%N)
+    "$@" > /dev/null
+    local t1=$(date +%s%N)
+    local ms=$(((t1 - t0) / 1000))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then
+      best=$ms
+    fi
+  done
+  printf "%d.%03d" $((best / 1000)) $((best % 1000))
+}
+
+measure() {
+  local name=$1 inc=$2
+  local lines=$($CXX $CXXFLAGS -I"$inc" -E "$tmp/tu.cc" | wc -l)
+  local syntax=$(best_ms $CXX $CXXFLAGS -I"$inc" -fsyntax-only "$tmp/tu.cc")
+  local obj=$(best_ms $CXX $CXXFLAGS -I"$inc" -O2 -c "$tmp/tu.cc" -o "$tmp/tu.o")
+  local inits=$(nm "$tmp/tu.o" | grep -c '_GLOBAL__sub_I' || true)
+  printf "%-8s %12s %14s %14s %12s\n" "$name" "$lines" "$syntax" "$obj" "$inits"
+}
+
+echo "$CXX $CXXFLAGS, best of $RUNS, before = $BEFORE"
+printf "%-8s %12s %14s %14s %12s\n" "" "pp lines" "syntax ms" "-O2 -c ms" "static init"
+measure before "$tmp/before"
+measure after "$PWD"
@@ -0,0 +1,84 @@
+#!/bin/bash
+# Build time of a synthetic project of N translation units that each use a
+# RefCell, once with #include "borrow.h" and once with import borrow;
+# (borrow.cppm). The module side includes building the module interface.
+# Both sides compile with -std=c++20 -O2 and the same BORROW_* flags.
+#
+# ./module_build_time.sh [tus] [jobs]
+#
+# tus defaults to 1000, jobs to nproc. CXX selects the compiler (g++ or
+# clang++); BORROW_FLAGS are passed to both sides, e.g. -DNDEBUG.
+set -e
+cd "$(dirname "$0")/.."
+REPO=$PWD
+CXX=${CXX:-g++}
+TUS=${1:-1000}
+JOBS=${2:-$(nproc)}
+FLAGS="-std=c++20 -O2 ${BORROW_FLAGS}"
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/include" "$tmp/import"
+
+gen() {
+  local dir=$1 head=$2
+  for ((i = 0; i < TUS; i++)); do
+    cat > "$dir/tu$i.cc" <<EOF
+$head
+int use_borrow_$i(borrow::RefCell<int>& cell) {
+  int sum = 0;
+  {
+    borrow::Ref<int> r = borrow::borrow_const(cell);
+    sum += *r;
+  }
+  borrow::RefMut<int> m = borrow::borrow_mut(cell);
+  return sum + $i;
+}
+EOF
+  done
+}
+gen "$tmp/include" '#include "borrow.h"'
+gen "$tmp/import" 'import borrow;'
+
+if $CXX --version | grep -q clang; then
+  bmi() {
+    $CXX $FLAGS -I"$REPO" --precompile -x c++-module "$REPO/borrow.cppm" -o borrow.pcm
+    $CXX $FLAGS -c borrow.pcm -o borrow.o
+  }
+  IMPORT_FLAGS="-fmodule-file=borrow=borrow.pcm"
+else
+  bmi() {
+    $CXX $FLAGS -fmodules-ts -I"$REPO" -x c++ -c "$REPO/borrow.cppm" -o borrow.o
+  }
+  IMPORT_FLAGS="-fmodules-ts"
+fi
+
+now_ms() {
+  echo $(($(date +%s%N) / 1000000))
+}
+
+compile_all() {
+  ls | grep '^tu.*\.cc$' | xargs -P "$JOBS" -I{} $CXX $FLAGS "$@" -c {} -o {}.o
+}
+
+cd "$tmp/include"
+t0=$(now_ms)
+compile_all -I"$REPO"
+t1=$(now_ms)
+include_ms=$((t1 - t0))
+
+cd "$tmp/import"
+t0=$(now_ms)
+bmi
+t1=$(now_ms)
+compile_all $IMPORT_FLAGS
+t2=$(now_ms)
+bmi_ms=$((t1 - t0))
+import_ms=$((t2 - t0))
+
+echo "$CXX, $TUS TUs, $JOBS jobs, $FLAGS"
+printf "%-22s %10s %12s\n" "" "total ms" "ms per TU"
+awk -v n=$TUS -v inc=$include_ms -v imp=$import_ms -v bmi=$bmi_ms 'BEGIN {
+  printf "%-22s %10d %12.2f\n", "#include \"borrow.h\"", inc, inc / n
+  printf "%-22s %10d %12.2f  (interface %d ms)\n", "import borrow;", imp, imp / n, bmi
+}'
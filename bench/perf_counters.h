@@ -0,0 +1,115 @@
+// Hardware counters around a measured loop, via perf_event_open(2).
+//
+// Each event is opened on its own for the calling thread (user space only,
+// so perf_event_paranoid <= 2 is enough) and skipped if the kernel or the
+// CPU does not have it. Counts are scaled by enabled/running time when the
+// kernel multiplexes. Cache-line transfers between cores (HITM) have no
+// generic event; set BORROW_PERF_HITM to the raw event code of your CPU
+// (e.g. 0x04d2 for MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM on Skylake) to count
+// them. In containers without a PMU nothing opens and available() is false,
+// so benchmarks fall back to timing only.
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class PerfCounters {
+ public:
+  enum Event { kCycles, kInstructions, kL1dMisses, kLlcMisses, kHitm, kEvents };
+
+  struct Sample {
+    double v[kEvents];
+    bool valid[kEvents];
+  };
+
+  PerfCounters() {
+    open_event(kCycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    open_event(kInstructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    open_event(kL1dMisses, PERF_TYPE_HW_CACHE,
+               PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    open_event(kLlcMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    const char* hitm = getenv("BORROW_PERF_HITM");
+    if (hitm != nullptr) {
+      open_event(kHitm, PERF_TYPE_RAW, strtoull(hitm, nullptr, 0));
+    } else {
+      fd_[kHitm] = -1;
+    }
+  }
+  PerfCounters(const PerfCounters&) = delete;
+  ~PerfCounters() {
+    for (int fd : fd_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  bool available() const {
+    for (int fd : fd_) {
+      if (fd >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // errno of the cycles counter, for saying why there are no counters
+  int error() const {
+    return error_;
+  }
+
+  static const char* name(int e) {
+    static const char* names[kEvents] = {"cycles", "instr", "L1d-miss", "LLC-miss", "HITM"};
+    return names[e];
+  }
+
+  void start() {
+    for (int fd : fd_) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+
+  Sample stop() {
+    Sample s;
+    for (int e = 0; e < kEvents; e++) {
+      if (fd_[e] >= 0) {
+        ioctl(fd_[e], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    for (int e = 0; e < kEvents; e++) {
+      uint64_t buf[3];  // value, time enabled, time running
+      s.valid[e] = fd_[e] >= 0 && read(fd_[e], buf, sizeof(buf)) == sizeof(buf) && buf[2] != 0;
+      s.v[e] = s.valid[e] ? static_cast<double>(buf[0]) * buf[1] / buf[2] : 0;
+    }
+    return s;
+  }
+
+ private:
+  void open_event(Event e, uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fd_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    if (fd_[e] < 0 && e == kCycles) {
+      error_ = errno;
+    }
+  }
+
+  int fd_[kEvents];
+  int error_{0};
+};
@@ -0,0 +1,89 @@
+// The borrow library as a C++20 named module:
+//
+//   import borrow;
+//
+// exports RefCell, Ref, RefMut, borrow_mut, borrow_const and reset_ptr (plus
+// the run-time knobs of the optional modes, see BORROW_EXPORT in borrow.h).
+// Macros do not cross a module boundary, so the configuration is fixed when
+// this interface is compiled: build it with the same BORROW_* flags you
+// would otherwise pass to every TU, and read it back in importers from the
+// constants in borrow::config. The failure path of borrow_diag.cc is
+// compiled into the module's object file. Build rules for GCC and Clang are
+// in README.md; bench/module_build_time.sh compares build times against
+// textual includes.
+module;
+// Everything borrow.h includes, in the global module fragment; the
+// include guards keep them out of the module purview below.
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <execinfo.h>
+#include <unistd.h>
+#include <utility>
+#if defined(BORROW_DEFERRED_REPORT) || defined(BORROW_REALTIME)
+#include <ctime>
+#endif
+#ifdef BORROW_REGISTRY
+#include <sys/syscall.h>
+#endif
+#ifdef BORROW_TRACE
+#include "borrow_trace.h"
+#endif
+export module borrow;
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 13 && (defined(BORROW_SAMPLED) || defined(BORROW_TRACE))
+#error "GCC 12 mishandles the thread_local state of BORROW_SAMPLED/BORROW_TRACE in modules; include borrow.h instead"
+#endif
+
+#define BORROW_EXPORT export
+#include "borrow.h"
+// the failure path, so that importers need not link borrow_diag.cc
+#include "borrow_diag.cc"
+
+namespace borrow {
+// The globals behind the holder templates, emitted in this unit: importers
+// only see the templates and, at least with GCC, do not instantiate them.
+#ifdef BORROW_DEFERRED_REPORT
+template struct ViolationLogHolder<void>;
+#endif
+#ifdef BORROW_SAMPLED
+template struct SampleRateHolder<void>;
+#endif
+#ifdef BORROW_REGISTRY
+template struct CellRegistryHolder<void>;
+#endif
+} // namespace borrow
+
+export namespace borrow::config {
+
+#ifdef BORROW_DEFERRED_REPORT
+inline constexpr bool deferred_report = true;
+#else
+inline constexpr bool deferred_report = false;
+#endif
+#ifdef BORROW_REALTIME
+inline constexpr bool realtime = true;
+#else
+inline constexpr bool realtime = false;
+#endif
+#ifdef BORROW_SAMPLED
+inline constexpr bool sampled = true;
+#else
+inline constexpr bool sampled = false;
+#endif
+#ifdef BORROW_REGISTRY
+inline constexpr bool registry = true;
+#else
+inline constexpr bool registry = false;
+#endif
+#ifdef BORROW_TRACE
+inline constexpr bool trace = true;
+#else
+inline constexpr bool trace = false;
+#endif
+inline constexpr bool debug = BORROW_DEBUG;
+inline constexpr bool generation = BORROW_GENERATION;
+inline constexpr unsigned cache_line_size = BORROW_CACHE_LINE_SIZE;
+
+} // namespace borrow::config
@@ -1,116 +1,600 @@
+#pragma once
 #include <cstdint>
-#include <memory>
 #include <utility>
 #include <atomic>
-#include <cassert>
-#include <cstdlib>
-#include <csignal>
+#if defined(BORROW_DEFERRED_REPORT) || defined(BORROW_REALTIME)
+#include <ctime>
+#ifndef BORROW_REALTIME
 #include <execinfo.h>
-#include <iostream>
+#endif
+#endif
+#ifdef BORROW_REGISTRY
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef BORROW_TRACE
+#include "borrow_trace.h"
+#else
+#define BORROW_TRACE_EVENT(op, p_cnt) do {} while(0)
+#endif
 namespace borrow {
 
+// Marks the declarations that the borrow module (borrow.cppm) exports; that
+// file includes this header in its purview with BORROW_EXPORT set to export.
+#ifndef BORROW_EXPORT
+#define BORROW_EXPORT
+#endif
+
+#if defined(BORROW_REALTIME) && !defined(BORROW_DEFERRED_REPORT)
+#define BORROW_DEFERRED_REPORT
+#endif
+
+#ifdef BORROW_DEFERRED_REPORT
+// Deferred reporting (log-and-continue): a failed check writes a compact
+// binary record into a preallocated lock-free ring and execution continues.
+// A background thread drains the ring with pop_violation() (see
+// borrow_report.h); nothing is formatted on the failing thread. When the
+// ring is full the record is dropped and counted.
+//
+// BORROW_REALTIME implies it. In that profile no borrow operation
+// allocates, takes a lock, prints or makes a system call, and only the
+// failing PC is recorded (backtrace() may allocate). RefCell::reset()
+// deletes the old value, so it is not real-time safe; use reset(T*) there.
+#ifndef BORROW_VIOLATION_LOG_SIZE
+#define BORROW_VIOLATION_LOG_SIZE 1024
+#endif
+#ifndef BORROW_VIOLATION_PCS
+#define BORROW_VIOLATION_PCS 4
+#endif
+
+BORROW_EXPORT enum class ViolationKind : uint8_t {
+  Other,
+  SharedWhileMut,      // borrow_const while mutably borrowed
+  MutWhileBorrowed,    // borrow_mut while borrowed
+  BadRelease,          // guard released with an impossible counter value
+  ResetWhileBorrowed,  // cell reset while borrowed
+};
+
+BORROW_EXPORT struct ViolationRecord {
+  uint64_t ts_ns;     // CLOCK_MONOTONIC
+  const void* cell;   // the cell's borrow counter, nullptr if unknown
+  const char* msg;
+  int32_t cnt;        // counter value seen by the failing check
+  ViolationKind kind;
+  uint8_t npcs;
+  void* pcs[BORROW_VIOLATION_PCS];  // pcs[0] is the failing check
+};
+
+struct ViolationLog {
+  static_assert((BORROW_VIOLATION_LOG_SIZE & (BORROW_VIOLATION_LOG_SIZE - 1)) == 0,
+                "BORROW_VIOLATION_LOG_SIZE must be a power of two");
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    ViolationRecord rec{};
+  };
+  // Bounded MPMC queue (Vyukov). Sequence numbers are stored relative to
+  // the slot index, so the all-zero initial state is already valid.
+  Slot slots[BORROW_VIOLATION_LOG_SIZE];
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  std::atomic<uint64_t> dropped{0};
+};
+
+// Header-only global without a dynamic initializer.
+template <class Dummy>
+struct ViolationLogHolder {
+  static ViolationLog log;
+};
+template <class Dummy>
+ViolationLog ViolationLogHolder<Dummy>::log;
+
+inline ViolationLog& violation_log() {
+  return ViolationLogHolder<void>::log;
+}
+
+__attribute__((noinline, cold)) inline void record_violation(const char* msg, ViolationKind kind,
+                                                             const void* cell, int32_t cnt) {
+  void* pc = __builtin_return_address(0);
+  ViolationLog& log = violation_log();
+  uint64_t pos = log.head.load(std::memory_order_relaxed);
+  for (;;) {
+    uint64_t idx = pos & (BORROW_VIOLATION_LOG_SIZE - 1);
+    auto& slot = log.slots[idx];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire) + idx;
+    if (seq == pos) {
+      if (log.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        ViolationRecord& rec = slot.rec;
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);  // vDSO, no system call
+        rec.ts_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+        rec.cell = cell;
+        rec.msg = msg;
+        rec.cnt = cnt;
+        rec.kind = kind;
+        rec.pcs[0] = pc;
+        rec.npcs = 1;
+#ifndef BORROW_REALTIME
+        void* frames[BORROW_VIOLATION_PCS + 1];
+        int n = backtrace(frames, BORROW_VIOLATION_PCS + 1);
+        // frames[0] is this function, frames[1] == pc
+        for (int i = 2; i < n; i++) {
+          rec.pcs[rec.npcs++] = frames[i];
+        }
+#endif
+        slot.seq.store(pos + 1 - idx, std::memory_order_release);
+        return;
+      }
+    } else if (seq < pos) {
+      log.dropped.fetch_add(1, std::memory_order_relaxed);  // full
+      return;
+    } else {
+      pos = log.head.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+// For the reporting thread. Returns false when the ring is empty.
+BORROW_EXPORT inline bool pop_violation(ViolationRecord& out) {
+  ViolationLog& log = violation_log();
+  uint64_t pos = log.tail.load(std::memory_order_relaxed);
+  for (;;) {
+    uint64_t idx = pos & (BORROW_VIOLATION_LOG_SIZE - 1);
+    auto& slot = log.slots[idx];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire) + idx;
+    if (seq == pos + 1) {
+      if (log.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        out = slot.rec;
+        slot.seq.store(pos + BORROW_VIOLATION_LOG_SIZE - idx, std::memory_order_release);
+        return true;
+      }
+    } else if (seq < pos + 1) {
+      return false;
+    } else {
+      pos = log.tail.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+BORROW_EXPORT inline uint64_t dropped_violations() {
+  return violation_log().dropped.load(std::memory_order_relaxed);
+}
+#endif
+
+// Failure path of the default borrow_verify, out of line so that this header
+// stays free of stdio/iostream/execinfo and of their static initializers.
+// Both are defined in borrow_diag.cc, which has to be linked into programs
+// using the default check (the borrow module compiles it in).
+[[noreturn]] __attribute__((cold)) void borrow_fail(const char* errmsg);
+void print_stack_trace();
+
 // Macros for custom error handling
-#define PRINT_STACK_TRACE() \
-    do { \
-        void* buffer[30]; \
-        int size = backtrace(buffer, 30); \
-        char** symbols = backtrace_symbols(buffer, size); \
-        if (symbols == nullptr) { \
-            std::cerr << "Failed to obtain stack trace." << std::endl; \
-            break; \
-        } \
-        std::cerr << "Stack trace:" << std::endl; \
-        for (int i = 0; i < size; ++i) { \
-            std::cerr << symbols[i] << std::endl; \
-        } \
-        free(symbols); \
-    } while(0)
+#define PRINT_STACK_TRACE() ::borrow::print_stack_trace()
 
 #ifndef borrow_verify
 #ifdef BORROW_INFER_CHECK
-#define borrow_verify(x) {if (!(x)) {volatile int* a = nullptr ; *a;}}
-//#define borrow_verify(x) nullptr
+#define borrow_verify(x, errmsg) do {if (!(x)) {volatile int* a = nullptr ; *a;}} while(0)
+#elif defined(BORROW_DEFERRED_REPORT)
+#define borrow_verify(x, errmsg) \
+    do { \
+        if (!(x)) { \
+            ::borrow::record_violation(errmsg, ::borrow::ViolationKind::Other, nullptr, 0); \
+        } \
+    } while(0)
 #else
 #define borrow_verify(x, errmsg) \
+    do { \
+        if (__builtin_expect(!(x), 0)) { \
+            ::borrow::borrow_fail(errmsg); \
+        } \
+    } while(0)
+#endif
+#endif
+
+// Like borrow_verify, for checks that know the cell's counter. In deferred
+// mode the kind, counter address and value go into the violation record.
+#ifndef borrow_verify_cnt
+#if defined(BORROW_DEFERRED_REPORT) && !defined(BORROW_INFER_CHECK)
+#define borrow_verify_cnt(x, errmsg, kind, p_cnt, value) \
     do { \
         if (!(x)) { \
-            fprintf(stderr, errmsg); \
-            PRINT_STACK_TRACE(); \
-            std::abort(); \
+            ::borrow::record_violation(errmsg, ::borrow::ViolationKind::kind, p_cnt, value); \
+        } \
+    } while(0)
+#else
+#define borrow_verify_cnt(x, errmsg, kind, p_cnt, value) borrow_verify(x, errmsg)
+#endif
+#endif
+
+// Sampled checking (BORROW_SAMPLED): every borrow and release still updates
+// the counter, but only one in N of them per thread reports a conflict,
+// picked by a thread-local countdown; N is set at run time with
+// set_sample_rate(), 1 reports everything, 0 nothing. This does not make
+// borrows cheaper: the counter update is the cost and the check is a compare
+// on its result (bench_borrow measures the same ns/op either way). What it
+// limits is how many conflicts get reported. An unsampled borrow or release
+// that sees a conflict does not report it but poisons the counter (parks it
+// far below zero), so that a reader over a writer cannot bring -1 back to 0
+// and every later sampled check on the cell fails.
+#ifdef BORROW_SAMPLED
+#ifndef BORROW_DEFAULT_SAMPLE_RATE
+#define BORROW_DEFAULT_SAMPLE_RATE 64
+#endif
+
+template <class Dummy>
+struct SampleRateHolder {
+  static std::atomic<uint32_t> rate;
+};
+template <class Dummy>
+std::atomic<uint32_t> SampleRateHolder<Dummy>::rate{BORROW_DEFAULT_SAMPLE_RATE};
+
+BORROW_EXPORT inline void set_sample_rate(uint32_t n) {
+  SampleRateHolder<void>::rate.store(n, std::memory_order_relaxed);
+}
+
+BORROW_EXPORT inline uint32_t sample_rate() {
+  return SampleRateHolder<void>::rate.load(std::memory_order_relaxed);
+}
+
+inline bool sample_borrow() {
+  static thread_local uint32_t countdown = 0;
+  if (countdown > 0) {
+    countdown--;
+    return false;
+  }
+  uint32_t n = sample_rate();
+  if (n == 0) {
+    return false;
+  }
+  countdown = n - 1;
+  return true;
+}
+
+static constexpr int32_t kPoisonedCount = -(1 << 30);
+
+#define borrow_verify_sampled(x, errmsg, kind, p_cnt, value) \
+    do { \
+        if (::borrow::sample_borrow()) { \
+            borrow_verify_cnt(x, errmsg, kind, p_cnt, value); \
+        } else if (__builtin_expect(!(x), 0)) { \
+            (p_cnt)->store(::borrow::kPoisonedCount); \
         } \
     } while(0)
-  
+#else
+#define borrow_verify_sampled(x, errmsg, kind, p_cnt, value) borrow_verify_cnt(x, errmsg, kind, p_cnt, value)
+#endif
+
+// BORROW_DEBUG turns on bookkeeping that only exists to catch bugs (view
+// counts, generations, ...). It follows NDEBUG unless set explicitly.
+#ifndef BORROW_DEBUG
+#ifdef NDEBUG
+#define BORROW_DEBUG 0
+#else
+#define BORROW_DEBUG 1
+#endif
+#endif
+
+// BORROW_GENERATION gives every RefCell a generation, bumped on reset().
+// Guards record it when borrowing and check it on each dereference, which
+// catches guards used after their cell was reset and refilled. Without it
+// the field does not exist.
+#ifndef BORROW_GENERATION
+#define BORROW_GENERATION BORROW_DEBUG
+#endif
+
+#if BORROW_GENERATION
+#define BORROW_CHECK_GENERATION() \
+    borrow_verify(p_gen_ == nullptr || *p_gen_ == gen_, "guard used after its RefCell was reset")
+#else
+#define BORROW_CHECK_GENERATION() do {} while(0)
+#endif
+
+#ifndef BORROW_CACHE_LINE_SIZE
+#define BORROW_CACHE_LINE_SIZE 64
+#endif
+
+// Live-cell registry (BORROW_REGISTRY): every RefCell registers itself in a
+// global fixed-size table when constructed and leaves it when destroyed, a
+// freelist pop (or a bump of the high-water mark) plus one store, and the
+// reverse. Borrows do no extra atomic read-modify-write; they only call out
+// to store the borrowing thread and site next to the counter with relaxed
+// stores (the last reader wins for shared borrows). borrow_registry.h dumps the borrowed
+// cells on demand or from a signal handler. Cells past
+// BORROW_REGISTRY_SIZE are not registered and only counted.
+#ifdef BORROW_REGISTRY
+#ifndef BORROW_REGISTRY_SIZE
+#define BORROW_REGISTRY_SIZE 65536
 #endif
+
+inline int32_t borrow_thread_id() {
+  static thread_local int32_t tid = static_cast<int32_t>(syscall(SYS_gettid));
+  return tid;
+}
+
+// Intrusive part of a registered cell.
+struct RegistryNode {
+  const std::atomic<int32_t>* p_cnt_{nullptr};
+  std::atomic<int32_t> holder_{0};        // thread id of the last borrow
+  std::atomic<const void*> site_{nullptr};
+  uint32_t slot_{UINT32_MAX};
+
+  inline explicit RegistryNode(const std::atomic<int32_t>* p_cnt);
+  inline ~RegistryNode();
+  RegistryNode(const RegistryNode&) = delete;
+
+  // Out of line so that its return address is the borrow's call site, also
+  // when the borrow itself was inlined.
+  __attribute__((noinline)) void borrowed() {
+    holder_.store(borrow_thread_id(), std::memory_order_relaxed);
+    site_.store(__builtin_return_address(0), std::memory_order_relaxed);
+  }
+};
+
+struct CellRegistry {
+  std::atomic<RegistryNode*> nodes[BORROW_REGISTRY_SIZE];
+  std::atomic<uint32_t> next_free[BORROW_REGISTRY_SIZE];  // slot + 1, 0 ends
+  std::atomic<uint64_t> free_head{0};  // ABA tag << 32 | (slot + 1)
+  std::atomic<uint32_t> high{0};       // slots ever handed out
+  std::atomic<uint64_t> unregistered{0};
+};
+
+template <class Dummy>
+struct CellRegistryHolder {
+  static CellRegistry registry;
+};
+template <class Dummy>
+CellRegistry CellRegistryHolder<Dummy>::registry;
+
+inline CellRegistry& cell_registry() {
+  return CellRegistryHolder<void>::registry;
+}
+
+inline RegistryNode::RegistryNode(const std::atomic<int32_t>* p_cnt) : p_cnt_(p_cnt) {
+  CellRegistry& reg = cell_registry();
+  uint64_t head = reg.free_head.load(std::memory_order_acquire);
+  while (static_cast<uint32_t>(head) != 0) {
+    uint32_t slot = static_cast<uint32_t>(head) - 1;
+    uint64_t next = ((head >> 32) + 1) << 32 | reg.next_free[slot].load(std::memory_order_relaxed);
+    if (reg.free_head.compare_exchange_weak(head, next, std::memory_order_acquire)) {
+      slot_ = slot;
+      break;
+    }
+  }
+  if (slot_ == UINT32_MAX) {
+    uint32_t slot = reg.high.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= BORROW_REGISTRY_SIZE) {
+      reg.unregistered.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    slot_ = slot;
+  }
+  reg.nodes[slot_].store(this, std::memory_order_release);
+}
+
+inline RegistryNode::~RegistryNode() {
+  if (slot_ == UINT32_MAX) {
+    return;
+  }
+  CellRegistry& reg = cell_registry();
+  reg.nodes[slot_].store(nullptr, std::memory_order_release);
+  uint64_t head = reg.free_head.load(std::memory_order_relaxed);
+  uint64_t next;
+  do {
+    reg.next_free[slot_].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    next = ((head >> 32) + 1) << 32 | (slot_ + 1);
+  } while (!reg.free_head.compare_exchange_weak(head, next, std::memory_order_release));
+}
 #endif
 
+// Raw pointer handed out by get_checked() for hot loops and C APIs. With
+// BORROW_DEBUG it remembers which borrow it came from and verifies on every
+// dereference that a borrow of that kind is still held on the cell (and, with
+// BORROW_GENERATION, that the cell was not reset since). Without it, it is a
+// plain T*.
+#if BORROW_DEBUG
+template <class T>
+class CheckedPtr {
+ public:
+  CheckedPtr() = default;
+  CheckedPtr(T* raw, const std::atomic<int32_t>* p_cnt, bool mut) : raw_(raw), p_cnt_(p_cnt), mut_(mut) {
+  }
+  T* operator->() const {
+    verify();
+    return raw_;
+  }
+  T& operator*() const {
+    verify();
+    return *raw_;
+  }
+  operator T*() const {
+    verify();
+    return raw_;
+  }
+#if BORROW_GENERATION
+  const std::atomic<uint32_t>* p_gen_{nullptr};
+  uint32_t gen_{0};
+#endif
 
+ private:
+  void verify() const {
+    if (p_cnt_ == nullptr) {
+      return;
+    }
+    int32_t c = p_cnt_->load(std::memory_order_relaxed);
+    borrow_verify(mut_ ? c == -1 : c > 0, "CheckedPtr used after its guard was released");
+    BORROW_CHECK_GENERATION();
+  }
+  T* raw_{nullptr};
+  const std::atomic<int32_t>* p_cnt_{nullptr};
+  bool mut_{false};
+};
+#else
+template <class T>
+using CheckedPtr = T*;
+#endif
 
-template<class T>
+BORROW_EXPORT template<class T>
 class Ref {
  public:
   const T* raw_{nullptr};
   std::atomic<int32_t>* p_cnt_{nullptr};
+#if BORROW_GENERATION
+  const std::atomic<uint32_t>* p_gen_{nullptr};
+  uint32_t gen_{0};
+#endif
   Ref() = default;
   Ref(const Ref&) = delete;
   Ref(Ref&& p) {
     raw_ = p.raw_; 
     p_cnt_ = p.p_cnt_;
+#if BORROW_GENERATION
+    p_gen_ = p.p_gen_;
+    gen_ = p.gen_;
+#endif
     p.raw_ = nullptr;
     p.p_cnt_ = nullptr;
   };
+  Ref& operator=(Ref&& p) {
+    if (this != &p) {
+      if (p_cnt_ != nullptr) {
+        reset();
+      }
+      std::swap(raw_, p.raw_);
+      std::swap(p_cnt_, p.p_cnt_);
+#if BORROW_GENERATION
+      std::swap(p_gen_, p.p_gen_);
+      std::swap(gen_, p.gen_);
+#endif
+    }
+    return *this;
+  }
   Ref(Ref& p) {
     raw_ = p.raw_;
     p_cnt_ = p.p_cnt_;
+#if BORROW_GENERATION
+    p_gen_ = p.p_gen_;
+    gen_ = p.gen_;
+#endif
     auto i = (*p_cnt_)++;
-    borrow_verify(i > 0, "error in Ref constructor");
+    borrow_verify_cnt(i > 0, "error in Ref constructor", BadRelease, p_cnt_, i);
+    BORROW_TRACE_EVENT(Shared, p_cnt_);
   }
   const T* operator->() {
+    BORROW_CHECK_GENERATION();
+    return raw_;
+  }
+  const T& operator*() {
+    BORROW_CHECK_GENERATION();
+    return *raw_;
+  }
+  explicit operator bool() const {
+    return p_cnt_ != nullptr;
+  }
+  // Raw access that must not outlive this guard; see CheckedPtr.
+  CheckedPtr<const T> get_checked() {
+    BORROW_CHECK_GENERATION();
+#if BORROW_DEBUG
+    CheckedPtr<const T> p(raw_, p_cnt_, false);
+#if BORROW_GENERATION
+    p.p_gen_ = p_gen_;
+    p.gen_ = gen_;
+#endif
+    return p;
+#else
     return raw_;
+#endif
   }
   void reset() {
+    BORROW_TRACE_EVENT(SharedRelease, p_cnt_);
     auto i = (*p_cnt_)--;
-    borrow_verify(i > 0, "Trying to reset null pointer");
+    borrow_verify_cnt(i > 0, "Trying to reset null pointer", BadRelease, p_cnt_, i);
     raw_ = nullptr;
     p_cnt_ = nullptr;
   }
   ~Ref() {
     if (p_cnt_ != nullptr) {
+      BORROW_TRACE_EVENT(SharedRelease, p_cnt_);
       auto i = (*p_cnt_)--;
-      borrow_verify(i > 0, "Trying to dereference null pointer"); // failure means - count became negative which is not possible
+      borrow_verify_sampled(i > 0, "Trying to dereference null pointer", BadRelease, p_cnt_, i); // failure means - count became negative which is not possible
     }
   }
 };
 
-template <typename T>
+BORROW_EXPORT template <typename T>
 class RefMut {
  public:
-  T* raw_;
-  std::atomic<int32_t>* p_cnt_;
+  T* raw_{nullptr};
+  std::atomic<int32_t>* p_cnt_{nullptr};
+#if BORROW_GENERATION
+  const std::atomic<uint32_t>* p_gen_{nullptr};
+  uint32_t gen_{0};
+#endif
   RefMut() = default;
   RefMut(const RefMut&) = delete;
   RefMut(RefMut&& p) : raw_(p.raw_), p_cnt_(p.p_cnt_) {
     raw_ = p.raw_;
+#if BORROW_GENERATION
+    p_gen_ = p.p_gen_;
+    gen_ = p.gen_;
+#endif
     p.p_cnt_ = nullptr;
     p.raw_ = nullptr;
   }
+  RefMut& operator=(RefMut&& p) {
+    if (this != &p) {
+      if (p_cnt_ != nullptr) {
+        reset();
+      }
+      std::swap(raw_, p.raw_);
+      std::swap(p_cnt_, p.p_cnt_);
+#if BORROW_GENERATION
+      std::swap(p_gen_, p.p_gen_);
+      std::swap(gen_, p.gen_);
+#endif
+    }
+    return *this;
+  }
   T* operator->() {
+    BORROW_CHECK_GENERATION();
+    return raw_;
+  }
+  T& operator*() {
+    BORROW_CHECK_GENERATION();
+    return *raw_;
+  }
+  explicit operator bool() const {
+    return p_cnt_ != nullptr;
+  }
+  // Raw access that must not outlive this guard; see CheckedPtr.
+  CheckedPtr<T> get_checked() {
+    BORROW_CHECK_GENERATION();
+#if BORROW_DEBUG
+    CheckedPtr<T> p(raw_, p_cnt_, true);
+#if BORROW_GENERATION
+    p.p_gen_ = p_gen_;
+    p.gen_ = gen_;
+#endif
+    return p;
+#else
     return raw_;
+#endif
   }
   void reset() {
+    BORROW_TRACE_EVENT(MutRelease, p_cnt_);
     auto i = (*p_cnt_)++;
-    borrow_verify(i == -1, "error in RefMut reset");
+    borrow_verify_cnt(i == -1, "error in RefMut reset", BadRelease, p_cnt_, i);
     p_cnt_ = nullptr;
     raw_ = nullptr;
   }
   ~RefMut() {
     if (p_cnt_) {
+      BORROW_TRACE_EVENT(MutRelease, p_cnt_);
       auto i = (*p_cnt_)++;
-      borrow_verify(i == -1, "error in checking just single reference of RefMut");
+      borrow_verify_sampled(i == -1, "error in checking just single reference of RefMut", BadRelease, p_cnt_, i);
     }
   }
 };
 
-template <class T>
+BORROW_EXPORT template <class T>
 class RefCell {
  public:
   RefCell(const RefCell&) = delete;
@@ -126,22 +610,43 @@ class RefCell {
     raw_ = p.raw_;
     p.raw_ = nullptr;
     p.cnt_ = 0;
+#if BORROW_GENERATION
+    gen_ = p.gen_.load();
+    p.gen_++;
+#endif
   };
 
   inline void reset(T* p) {
-    borrow_verify(cnt_ == 0, "error in RefCell reset");
+    borrow_verify_cnt(cnt_ == 0, "error in RefCell reset", ResetWhileBorrowed, &cnt_, cnt_.load());
+#if BORROW_GENERATION
+    gen_++;
+#endif
     raw_ = p;
-    borrow_verify(cnt_ == 0, "error in RefCell reset"); // is this enough to capture data race?
+    borrow_verify_cnt(cnt_ == 0, "error in RefCell reset", ResetWhileBorrowed, &cnt_, cnt_.load()); // is this enough to capture data race?
   }
   T* raw_{nullptr};
   std::atomic<int32_t> cnt_{0};
+#if BORROW_GENERATION
+  std::atomic<uint32_t> gen_{0};
+#endif
+#ifdef BORROW_REGISTRY
+  RegistryNode reg_{&cnt_};
+#endif
 
   inline RefMut<T> borrow_mut() {
     RefMut<T> mut;
-    borrow_verify(cnt_ == 0, "verify failed in borrow_mut");
-    cnt_--;
+    auto i = cnt_--;
+    borrow_verify_sampled(i == 0, "verify failed in borrow_mut", MutWhileBorrowed, &cnt_, i);
+#ifdef BORROW_REGISTRY
+    reg_.borrowed();
+#endif
+    BORROW_TRACE_EVENT(Mut, &cnt_);
     mut.p_cnt_ = &cnt_;
     mut.raw_ = raw_;
+#if BORROW_GENERATION
+    mut.p_gen_ = &gen_;
+    mut.gen_ = gen_;
+#endif
     raw_ = nullptr;
     return mut;
   }
@@ -149,10 +654,18 @@ class RefCell {
   inline Ref<T> borrow_const() {
     // *raw_; // for refer static analysis
     auto i = cnt_++;
-    borrow_verify(i >= 0, "verify failed in borrow_const");
+    borrow_verify_sampled(i >= 0, "verify failed in borrow_const", SharedWhileMut, &cnt_, i);
+#ifdef BORROW_REGISTRY
+    reg_.borrowed();
+#endif
+    BORROW_TRACE_EVENT(Shared, &cnt_);
     Ref<T> ref;
     ref.raw_ = raw_;
     ref.p_cnt_ = &cnt_;
+#if BORROW_GENERATION
+    ref.p_gen_ = &gen_;
+    ref.gen_ = gen_;
+#endif
     return ref;
   }
 
@@ -162,7 +675,10 @@ class RefCell {
   }
 
   void reset() {
-    borrow_verify(cnt_ == 0, "verify failed in RefCell reset");
+    borrow_verify_cnt(cnt_ == 0, "verify failed in RefCell reset", ResetWhileBorrowed, &cnt_, cnt_.load());
+#if BORROW_GENERATION
+    gen_++;
+#endif
     delete raw_;
     raw_ = nullptr;
   }
@@ -174,27 +690,27 @@ class RefCell {
   }
 };
 
-template <typename T>
+BORROW_EXPORT template <typename T>
 inline RefMut<T> borrow_mut(RefCell<T>& RefCell) {
   return std::forward<RefMut<T>>(RefCell.borrow_mut());
 }
 
-template <typename T>
+BORROW_EXPORT template <typename T>
 inline Ref<T> borrow_const(RefCell<T>& RefCell) {
   return std::forward<Ref<T>>(RefCell.borrow_const());
 }
 
-template <typename T>
+BORROW_EXPORT template <typename T>
 inline void reset_ptr(RefCell<T>& ptr) {
   return ptr.reset();
 }
 
-template <typename T>
+BORROW_EXPORT template <typename T>
 inline void reset_ptr(RefMut<T>& ptr) {
   return ptr.reset();
 }
 
-template <typename T>
+BORROW_EXPORT template <typename T>
 inline void reset_ptr(Ref<T>& ptr) {
   return ptr.reset();
 }
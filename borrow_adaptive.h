@@ -0,0 +1,435 @@
+#pragma once
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <sched.h>
+#include "borrow.h"
+#include "borrow_futex.h"
+namespace borrow {
+
+// Thread-safe cell that picks its reader/writer protocol at run time from
+// the contention it observes.
+//
+//  - Counter: one counter, RefCell protocol; waiters spin and yield. This is
+//    the starting mode and the cheapest one for cold cells.
+//  - PerCore: readers count themselves in per-CPU slots, so concurrent
+//    readers stop bouncing one cache line. Writers close the counter to new
+//    readers, wait for every slot to drain, and take the cell once a last
+//    look finds the slots empty.
+//  - Parking: counter protocol, but waiters sleep on a futex after a short
+//    spin instead of burning CPU while writers hold the cell.
+//
+// Writers always exclude both kinds of readers, so every mode is correct no
+// matter which mode the threads currently in the cell borrowed under, and a
+// switch is a single store. A thread that already holds a read may be what
+// a draining writer waits for, so its further reads enter through the slots
+// while the writer drains instead of waiting for it; nested reads never
+// deadlock, in any mode.
+//
+// One in `sample_every` borrows per thread is sampled: it adds whether it
+// had to wait, the reader fan-out it saw and whether it was a write to the
+// cell's window. The sample that closes a window picks the next mode: a
+// high reader fan-out with few writes goes to PerCore, frequent waiting
+// otherwise goes to Parking, and a window that saw little contention, or
+// took longer than `cool_ns` (traffic cooled down), goes back to Counter.
+// A window older than `cool_ns` is closed by its next sample, so a cell
+// whose traffic cools off falls back without filling the window first.
+// Unsampled borrows only touch the counter or their slot; with
+// `sample_every` 0 nothing is sampled and the cell stays in `start`.
+
+enum class AdaptiveMode : uint8_t {
+  Counter,
+  PerCore,
+  Parking,
+};
+
+struct AdaptivePolicy {
+  AdaptiveMode start{AdaptiveMode::Counter};
+  uint32_t sample_every{64};       // per thread; 0 never samples
+  uint32_t window{128};            // samples per decision
+  double hot_contention{0.25};     // fraction of waiting samples that leaves Counter
+  double cool_contention{0.02};    // ... and that goes back to it
+  double percore_fanout{2.0};      // mean readers seen by a sampled reader
+  double percore_max_writes{0.05}; // fraction of writes PerCore tolerates
+  uint64_t cool_ns{50000000};      // a window slower than this is cold
+};
+
+struct AdaptiveStats {
+  AdaptiveMode mode;
+  uint64_t switches;
+  uint64_t samples;    // over the cell's lifetime
+  uint64_t contended;  // sampled borrows that had to wait
+};
+
+namespace detail {
+
+// Part of the cell the guards need on release.
+struct AdaptiveWake {
+  std::atomic<int32_t> parked_{0};
+  std::atomic<int32_t> wake_{0};
+
+  inline void released() {
+    if (parked_.load() > 0) {
+      wake_++;
+      futex_wake_all(&wake_);
+    }
+  }
+};
+
+inline bool adaptive_sample(uint32_t every) {
+  static thread_local uint32_t countdown = 0;
+  if (every == 0) {
+    return false;
+  }
+  if (countdown > 0) {
+    countdown--;
+    return false;
+  }
+  countdown = every - 1;
+  return true;
+}
+
+// AdaptiveCell reads held by this thread.
+inline int32_t& adaptive_reads_held() {
+  static thread_local int32_t held = 0;
+  return held;
+}
+
+template <class G>
+struct AdaptiveIsRead : std::false_type {};
+template <class T>
+struct AdaptiveIsRead<Ref<T>> : std::true_type {};
+
+} // namespace detail
+
+// Guard over an adaptive borrow. Wraps Ref<T>/RefMut<T> and wakes parked
+// waiters on release. A read counts as held by the borrowing thread, so it
+// must be released on that thread.
+template <class G>
+class AdaptiveGuard {
+ public:
+  AdaptiveGuard() = default;
+  AdaptiveGuard(const AdaptiveGuard&) = delete;
+  AdaptiveGuard(G&& g, detail::AdaptiveWake* wake) : g_(std::move(g)), wake_(wake) {
+    if (detail::AdaptiveIsRead<G>::value) {
+      detail::adaptive_reads_held()++;
+    }
+  }
+  AdaptiveGuard(AdaptiveGuard&& p) : g_(std::move(p.g_)), wake_(p.wake_) {
+    p.wake_ = nullptr;
+  }
+  ~AdaptiveGuard() {
+    reset();
+  }
+  auto operator->() -> decltype(std::declval<G&>().operator->()) {
+    return g_.operator->();
+  }
+  auto operator*() -> decltype(*std::declval<G&>()) {
+    return *g_;
+  }
+  explicit operator bool() const {
+    return static_cast<bool>(g_);
+  }
+  void reset() {
+    if (g_) {
+      g_.reset();
+      wake_->released();
+      if (detail::AdaptiveIsRead<G>::value) {
+        detail::adaptive_reads_held()--;
+      }
+    }
+    wake_ = nullptr;
+  }
+
+ private:
+  G g_;
+  detail::AdaptiveWake* wake_{nullptr};
+};
+
+template <class T>
+using AdaptiveRef = AdaptiveGuard<Ref<T>>;
+template <class T>
+using AdaptiveRefMut = AdaptiveGuard<RefMut<T>>;
+
+template <class T>
+class AdaptiveCell {
+  static constexpr size_t kSlots = 16;
+  // Counter value while a writer waits for the slots to drain; -1 once it
+  // holds the cell.
+  static constexpr int32_t kDraining = -2;
+  struct alignas(BORROW_CACHE_LINE_SIZE) Slot {
+    std::atomic<int32_t> cnt_{0};
+  };
+
+ public:
+  AdaptiveCell(const AdaptiveCell&) = delete;
+  explicit AdaptiveCell(T* p = nullptr, const AdaptivePolicy& policy = AdaptivePolicy())
+      : raw_(p), policy_(policy), mode_(policy.start) {
+    window_start_.store(now_ns(), std::memory_order_relaxed);
+    if (policy_.start == AdaptiveMode::PerCore) {
+      alloc_slots();
+    }
+  }
+  ~AdaptiveCell() {
+    borrow_verify(cnt_ == 0, "AdaptiveCell destroyed while borrowed");
+    Slot* slots = slots_.load();
+    if (slots != nullptr) {
+      for (size_t i = 0; i < kSlots; i++) {
+        borrow_verify(slots[i].cnt_ == 0, "AdaptiveCell destroyed while borrowed");
+      }
+      free(slots);
+    }
+    delete raw_;
+  }
+
+  inline AdaptiveRef<T> borrow_const() {
+    bool sampled = detail::adaptive_sample(policy_.sample_every);
+    bool waited = false;
+    int32_t fanout = 0;
+    bool nested = detail::adaptive_reads_held() > 0;
+    // may enter now: no writer, or (for a nested read) one that still drains
+    auto open = [this, nested] {
+      int32_t c = cnt_.load();
+      return c >= 0 || (nested && c == kDraining);
+    };
+    std::atomic<int32_t>* p_cnt = nullptr;
+    for (;;) {
+      // acquire pairs with the release in decide(): PerCore implies slots_
+      bool percore = mode_.load(std::memory_order_acquire) == AdaptiveMode::PerCore;
+      Slot* slots = slots_.load();
+      int32_t c = cnt_.load();
+      if (percore || (nested && c == kDraining && slots != nullptr)) {
+        std::atomic<int32_t>* slot = &slots[static_cast<unsigned>(sched_getcpu()) % kSlots].cnt_;
+        (*slot)++;
+        if (open()) {
+          p_cnt = slot;
+          break;
+        }
+        // a writer holds or is draining the cell
+        (*slot)--;
+        wake_.released();
+      } else if (c >= 0) {
+        if (cnt_.compare_exchange_weak(c, c + 1)) {
+          p_cnt = &cnt_;
+          fanout = c + 1;
+          break;
+        }
+        waited = true;  // lost a race with another reader
+        continue;
+      }
+      waited = true;
+      wait(open);
+    }
+    if (sampled) {
+      sample(waited, fanout, false);
+    }
+    Ref<T> ref;
+    ref.raw_ = raw_;
+    ref.p_cnt_ = p_cnt;
+    return AdaptiveRef<T>(std::move(ref), &wake_);
+  }
+
+  inline AdaptiveRefMut<T> borrow_mut() {
+    bool sampled = detail::adaptive_sample(policy_.sample_every);
+    bool waited = false;
+    int32_t expected = 0;
+    while (!cnt_.compare_exchange_weak(expected, kDraining)) {
+      waited = true;
+      wait([this] { return cnt_.load() == 0; });
+      expected = 0;
+    }
+    // Nested reads still enter the slots while we drain; the last look
+    // after closing the cell pairs with their look at the counter.
+    for (;;) {
+      Slot* slots = slots_.load();
+      if (slots != nullptr) {
+        for (size_t i = 0; i < kSlots; i++) {
+          if (slots[i].cnt_.load() != 0) {
+            waited = true;
+            wait([&slots, i] { return slots[i].cnt_.load() == 0; });
+          }
+        }
+      }
+      cnt_.store(-1);
+      if (slots_empty()) {
+        break;
+      }
+      cnt_.store(kDraining);
+      wake_.released();  // nested readers waiting for the drain
+    }
+    if (sampled) {
+      sample(waited, 0, true);
+    }
+    RefMut<T> mut;
+    mut.p_cnt_ = &cnt_;
+    mut.raw_ = raw_;
+    return AdaptiveRefMut<T>(std::move(mut), &wake_);
+  }
+
+  AdaptiveMode mode() const {
+    return mode_.load(std::memory_order_acquire);
+  }
+
+  AdaptiveStats stats() const {
+    AdaptiveStats s;
+    s.mode = mode();
+    s.switches = switches_.load(std::memory_order_relaxed);
+    s.samples = total_samples_.load(std::memory_order_relaxed);
+    s.contended = total_contended_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+ private:
+  static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+
+  bool slots_empty() const {
+    Slot* slots = slots_.load();
+    for (size_t i = 0; slots != nullptr && i < kSlots; i++) {
+      if (slots[i].cnt_.load() != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <class Pred>
+  void wait(const Pred& ready) {
+    for (int spin = 0; spin < 64; spin++) {
+      if (ready()) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+    while (!ready()) {
+      if (mode_.load(std::memory_order_relaxed) != AdaptiveMode::Parking) {
+        std::this_thread::yield();
+        continue;
+      }
+      // Register before the last check; a release after it sees parked_
+      // and bumps wake_, so the futex wait returns.
+      wake_.parked_++;
+      int32_t seen = wake_.wake_.load();
+      if (!ready()) {
+        detail::futex_wait(&wake_.wake_, seen);
+      }
+      wake_.parked_--;
+    }
+  }
+
+  void sample(bool waited, int32_t fanout, bool write) {
+    total_samples_.fetch_add(1, std::memory_order_relaxed);
+    if (waited) {
+      total_contended_.fetch_add(1, std::memory_order_relaxed);
+      win_contended_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (write) {
+      win_writes_.fetch_add(1, std::memory_order_relaxed);
+    } else if (fanout > 0) {
+      win_fanout_.fetch_add(static_cast<uint64_t>(fanout), std::memory_order_relaxed);
+      win_fanout_samples_.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint32_t n = win_samples_.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint64_t now = now_ns();
+    uint64_t start = window_start_.load(std::memory_order_relaxed);
+    if (n == policy_.window) {
+      window_start_.store(now, std::memory_order_relaxed);
+      decide(n, now - start > policy_.cool_ns);
+    } else if (now - start > policy_.cool_ns &&
+               window_start_.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+      decide(n, true);  // traffic cooled down before the window filled
+    }
+  }
+
+  // Runs on the thread whose sample closed the window; samples racing with
+  // the reset below land in this or the next window, which is fine for
+  // statistics.
+  void decide(double n, bool cold) {
+    double contention = win_contended_.exchange(0, std::memory_order_relaxed) / n;
+    double writes = win_writes_.exchange(0, std::memory_order_relaxed) / n;
+    uint64_t fanout_n = win_fanout_samples_.exchange(0, std::memory_order_relaxed);
+    double fanout = fanout_n == 0 ? 0 : static_cast<double>(win_fanout_.exchange(0, std::memory_order_relaxed)) / fanout_n;
+    win_samples_.store(0, std::memory_order_relaxed);
+
+    AdaptiveMode cur = mode();
+    AdaptiveMode next = cur;
+    if (cold && contention < policy_.hot_contention) {
+      // long holds make windows slow too; those are not cold
+      next = AdaptiveMode::Counter;
+    } else if (n < policy_.window) {
+      // closed early by the clock: too few samples to pick anything else
+    } else if (cur == AdaptiveMode::Counter) {
+      // Overlapping readers bounce the counter's cache line whether or not
+      // their CAS fails, so fan-out alone is enough to go PerCore.
+      if (fanout >= policy_.percore_fanout && writes <= policy_.percore_max_writes) {
+        next = AdaptiveMode::PerCore;
+      } else if (contention >= policy_.hot_contention) {
+        next = AdaptiveMode::Parking;
+      }
+    } else if (cur == AdaptiveMode::PerCore) {
+      // readers no longer contend on the counter here, so leave only when
+      // writes make draining the slots too expensive
+      if (writes > policy_.percore_max_writes) {
+        next = contention >= policy_.hot_contention ? AdaptiveMode::Parking : AdaptiveMode::Counter;
+      }
+    } else if (contention < policy_.cool_contention) {
+      next = AdaptiveMode::Counter;
+    }
+    if (next != cur) {
+      if (next == AdaptiveMode::PerCore && slots_.load() == nullptr) {
+        alloc_slots();
+      }
+      mode_.store(next, std::memory_order_release);  // after slots_
+      switches_.fetch_add(1, std::memory_order_relaxed);
+      wake_.released();  // parked waiters go back to spinning
+    }
+  }
+
+  // Slots are only allocated by cells that went PerCore once, and kept.
+  void alloc_slots() {
+    void* p = nullptr;
+    bool ok = posix_memalign(&p, BORROW_CACHE_LINE_SIZE, sizeof(Slot) * kSlots) == 0;
+    borrow_verify(ok, "AdaptiveCell failed to allocate reader slots");
+    Slot* slots = static_cast<Slot*>(p);
+    for (size_t i = 0; i < kSlots; i++) {
+      new (&slots[i]) Slot();
+    }
+    Slot* expected = nullptr;
+    if (!slots_.compare_exchange_strong(expected, slots)) {
+      free(slots);
+    }
+  }
+
+  T* raw_;
+  std::atomic<int32_t> cnt_{0};
+  AdaptivePolicy policy_;
+  std::atomic<AdaptiveMode> mode_;
+  std::atomic<Slot*> slots_{nullptr};
+  detail::AdaptiveWake wake_;
+  alignas(BORROW_CACHE_LINE_SIZE) std::atomic<uint32_t> win_samples_{0};
+  std::atomic<uint64_t> win_contended_{0};
+  std::atomic<uint64_t> win_writes_{0};
+  std::atomic<uint64_t> win_fanout_{0};
+  std::atomic<uint64_t> win_fanout_samples_{0};
+  std::atomic<uint64_t> window_start_{0};
+  std::atomic<uint64_t> switches_{0};
+  std::atomic<uint64_t> total_samples_{0};
+  std::atomic<uint64_t> total_contended_{0};
+};
+
+template <typename T>
+inline AdaptiveRef<T> borrow_const(AdaptiveCell<T>& cell) {
+  return cell.borrow_const();
+}
+
+template <typename T>
+inline AdaptiveRefMut<T> borrow_mut(AdaptiveCell<T>& cell) {
+  return cell.borrow_mut();
+}
+
+} // namespace borrow
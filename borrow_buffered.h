@@ -0,0 +1,129 @@
+#pragma once
+#include <cstddef>
+#include "borrow.h"
+namespace borrow {
+
+// Multi-buffered cell for one writer publishing to many readers.
+//
+// The writer takes a RefMut on a back buffer with borrow_back(), fills it
+// and hands it to publish(), which releases it and makes it the latest
+// version. Readers borrow_const() the latest published buffer; they only
+// ever touch that buffer's counter and never wait for the writer.
+//
+// A buffer is only picked as back buffer when its counter is 0, so a buffer
+// still borrowed by some reader is never reused. Readers never bump a
+// negative counter, so they can not disturb the writer's borrow either. A
+// back buffer dropped without publish() goes back to counter 0 with
+// unpublished content, so a reader that read latest_ before it was reused
+// checks latest_ again once it holds the count, and retries if the buffer
+// is no longer the latest one. With
+// N buffers the writer always finds a free one unless N - 1 older versions
+// are still pinned by readers; borrow_back() then returns an empty RefMut.
+template <class T, size_t N = 3>
+class BufferedCell {
+  static_assert(N >= 2, "BufferedCell needs at least two buffers");
+
+  struct alignas(BORROW_CACHE_LINE_SIZE) Slot {
+    T value;
+    std::atomic<int32_t> cnt_{0};
+  };
+
+ public:
+  BufferedCell(const BufferedCell&) = delete;
+  // Every buffer starts as a copy of `init`.
+  explicit BufferedCell(const T& init = T()) {
+    for (auto& s : slots_) {
+      s.value = init;
+    }
+  }
+
+  inline Ref<T> borrow_const() {
+    for (;;) {
+      size_t i = latest_.load(std::memory_order_acquire);
+      Slot& s = slots_[i];
+      int32_t c = s.cnt_.load();
+      while (c >= 0) {
+        if (s.cnt_.compare_exchange_weak(c, c + 1)) {
+          // The writer can not take the buffer while we count, so if it is
+          // still the latest it holds a published version.
+          if (latest_.load(std::memory_order_acquire) == i) {
+            Ref<T> ref;
+            ref.raw_ = &s.value;
+            ref.p_cnt_ = &s.cnt_;
+            return ref;
+          }
+          s.cnt_--;
+          break;
+        }
+      }
+      // The writer took this buffer after we read latest_; it has published
+      // a newer one since.
+    }
+  }
+
+  // Writer side: a buffer that is neither the latest nor borrowed. Its
+  // content is whatever version it held last, or what a previous back
+  // buffer borrow dropped without publish() left in it; readers never see
+  // it before it is published.
+  inline RefMut<T> borrow_back() {
+    size_t latest = latest_.load(std::memory_order_relaxed);
+    for (size_t n = 1; n < N; n++) {
+      Slot& s = slots_[(latest + n) % N];
+      int32_t expected = 0;
+      if (s.cnt_.compare_exchange_strong(expected, -1)) {
+        RefMut<T> mut;
+        mut.p_cnt_ = &s.cnt_;
+        mut.raw_ = &s.value;
+        return mut;
+      }
+    }
+    return RefMut<T>();
+  }
+
+  // Like borrow_back(), with the back buffer overwritten by the latest
+  // version, for writers that update in place.
+  inline RefMut<T> borrow_back_copy() {
+    RefMut<T> mut = borrow_back();
+    if (mut) {
+      Ref<T> cur = borrow_const();
+      *mut = *cur;
+    }
+    return mut;
+  }
+
+  // Releases the back buffer and makes it the latest version.
+  inline void publish(RefMut<T>&& back) {
+    borrow_verify(back, "publishing an empty RefMut");
+    size_t i = index_of(back.raw_);
+    back.reset();
+    latest_.store(i, std::memory_order_release);
+    published_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Number of publish() calls so far.
+  uint64_t published() const {
+    return published_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  size_t index_of(const T* p) {
+    for (size_t i = 0; i < N; i++) {
+      if (&slots_[i].value == p) {
+        return i;
+      }
+    }
+    borrow_verify(false, "RefMut does not belong to this BufferedCell");
+    return 0;
+  }
+
+  alignas(BORROW_CACHE_LINE_SIZE) std::atomic<size_t> latest_{0};
+  std::atomic<uint64_t> published_{0};
+  Slot slots_[N];
+};
+
+template <typename T, size_t N>
+inline Ref<T> borrow_const(BufferedCell<T, N>& cell) {
+  return cell.borrow_const();
+}
+
+} // namespace borrow
@@ -0,0 +1,197 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <vector>
+#include "borrow_versioned.h"
+namespace borrow {
+
+// Memoized values derived from versioned cells.
+//
+// A Derived<T> runs its compute function with a DeriveContext; every input
+// read through the context is borrowed and its version recorded. get()
+// recomputes only when one of the recorded versions moved on. Derived values
+// are versioned themselves (the version bumps on every recompute), so they
+// can be inputs of other Derived values.
+//
+// Lazy invalidation compares the recorded versions on every get(), first
+// bringing Derived inputs up to date. Eager invalidation subscribes to the
+// inputs instead: a change marks the value stale and is passed on to the
+// Derived's own subscribers, so get() on a clean value over plain cells is a
+// flag check. A lazy Derived input tells nobody about changes, so Derived
+// inputs are brought up to date and compared on every get() under either
+// policy. Likewise a cell attached to a DirtySet only notifies in drain(),
+// so its version is compared on every get() too.
+//
+// Recomputing replaces the cached value, so it needs the value to be
+// unborrowed; a stale get() while a Ref of the old value is alive fails
+// borrow_verify. Inputs must outlive the Derived values reading them.
+
+template <class T>
+class Derived;
+
+class DeriveContext {
+ public:
+  template <class U>
+  inline Ref<U> read(VersionedCell<U>& cell) {
+    Ref<U> ref = cell.borrow_const();
+    // the version can not move while we hold the borrow
+    deps_.push_back(Dep{&cell, cell.version(), nullptr});
+    return ref;
+  }
+
+  template <class U>
+  inline Ref<U> read(Derived<U>& d) {
+    Ref<U> ref = d.get();
+    deps_.push_back(Dep{&d, d.version(), &Derived<U>::refresh_thunk});
+    return ref;
+  }
+
+ private:
+  template <class T>
+  friend class Derived;
+
+  struct Dep {
+    VersionedBase* cell;
+    uint64_t version;
+    void (*refresh)(VersionedBase*);  // brings a Derived input up to date
+  };
+  std::vector<Dep> deps_;
+};
+
+enum class Invalidation {
+  Lazy,
+  Eager,
+};
+
+template <class T>
+class Derived : public VersionedBase {
+ public:
+  using Compute = std::function<T(DeriveContext&)>;
+
+  explicit Derived(Compute fn, Invalidation mode = Invalidation::Lazy) : fn_(std::move(fn)), mode_(mode) {
+  }
+  ~Derived() {
+    borrow_verify(cnt_ == 0, "Derived destroyed while borrowed");
+    unsubscribe_all();
+  }
+
+  // The current value, recomputed first if an input changed.
+  inline Ref<T> get() {
+    refresh();
+    auto i = cnt_++;
+    borrow_verify(i >= 0, "verify failed in Derived get");
+    Ref<T> ref;
+    ref.raw_ = value_.get();
+    ref.p_cnt_ = &cnt_;
+    return ref;
+  }
+
+  // Recompute now if anything changed. Returns true if it recomputed.
+  inline bool refresh() {
+    if (!stale()) {
+      return false;
+    }
+    recompute();
+    return true;
+  }
+
+  bool stale() {
+    if (value_ == nullptr || stale_.load(std::memory_order_acquire)) {
+      return true;
+    }
+    for (auto& d : deps_) {
+      if (d.refresh != nullptr) {
+        d.refresh(d.cell);
+      } else if (mode_ == Invalidation::Eager && d.cell->dirty_set() == nullptr) {
+        continue;  // a plain cell notifies us on release
+      }
+      if (d.cell->version() != d.version) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Force the next get() to recompute.
+  void invalidate() {
+    on_input_changed();
+  }
+
+  static void refresh_thunk(VersionedBase* p) {
+    static_cast<Derived*>(p)->refresh();
+  }
+
+ private:
+  void recompute() {
+    borrow_verify(!computing_, "cycle in Derived computation");
+    int32_t expected = 0;
+    bool ok = cnt_.compare_exchange_strong(expected, -1);
+    borrow_verify(ok, "Derived recomputed while its value is borrowed");
+    computing_ = true;
+    stale_.store(false, std::memory_order_release);
+    DeriveContext ctx;
+    std::unique_ptr<T> v(new T(fn_(ctx)));
+    computing_ = false;
+    value_ = std::move(v);
+    if (mode_ == Invalidation::Eager) {
+      resubscribe(ctx.deps_);
+    }
+    deps_ = std::move(ctx.deps_);
+    version_.fetch_add(1, std::memory_order_release);
+    cnt_++;
+  }
+
+  // Keep exactly one subscription per input across recomputations.
+  void resubscribe(const std::vector<DeriveContext::Dep>& deps) {
+    std::vector<Subscription> keep;
+    for (auto& d : deps) {
+      bool found = false;
+      for (auto& k : keep) {
+        found = found || k.cell == d.cell;
+      }
+      for (auto& s : subs_) {
+        if (!found && s.cell == d.cell) {
+          keep.push_back(s);
+          s.cell = nullptr;
+          found = true;
+        }
+      }
+      if (!found) {
+        size_t id = d.cell->subscribe([this](VersionedBase&) { on_input_changed(); });
+        keep.push_back(Subscription{d.cell, id});
+      }
+    }
+    unsubscribe_all();
+    subs_ = std::move(keep);
+  }
+
+  void unsubscribe_all() {
+    for (auto& s : subs_) {
+      if (s.cell != nullptr) {
+        s.cell->unsubscribe(s.id);
+      }
+    }
+    subs_.clear();
+  }
+
+  void on_input_changed() {
+    if (!stale_.exchange(true, std::memory_order_acq_rel)) {
+      notify();
+    }
+  }
+
+  struct Subscription {
+    VersionedBase* cell;
+    size_t id;
+  };
+
+  Compute fn_;
+  Invalidation mode_;
+  std::unique_ptr<T> value_;
+  std::vector<DeriveContext::Dep> deps_;
+  std::vector<Subscription> subs_;
+  std::atomic<bool> stale_{false};
+  bool computing_{false};
+};
+
+} // namespace borrow
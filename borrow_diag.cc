@@ -0,0 +1,29 @@
+// Diagnostics behind borrow.h's default borrow_verify: the failure message
+// and a stack trace on stderr, then abort. Compile it once into every
+// program that uses the default check; builds with BORROW_DEFERRED_REPORT,
+// BORROW_INFER_CHECK or their own borrow_verify do not need it.
+//
+// g++ -std=c++11 -O2 -c borrow_diag.cc
+#include <cstdio>
+#include <cstdlib>
+#include <execinfo.h>
+#include <unistd.h>
+#include "borrow.h"
+namespace borrow {
+
+void print_stack_trace() {
+  void* buffer[30];
+  int size = backtrace(buffer, 30);
+  fputs("Stack trace:\n", stderr);
+  fflush(stderr);
+  // unlike backtrace_symbols(), does not allocate
+  backtrace_symbols_fd(buffer, size, STDERR_FILENO);
+}
+
+void borrow_fail(const char* errmsg) {
+  fprintf(stderr, "%s\n", errmsg);
+  print_stack_trace();
+  std::abort();
+}
+
+} // namespace borrow
@@ -0,0 +1,25 @@
+#pragma once
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+namespace borrow {
+namespace detail {
+
+// Futex on a borrow counter or wake word. Not private, so the word may live
+// in memory shared between processes.
+
+// Returns when woken, on timeout, or right away if *addr != expected.
+inline void futex_wait(std::atomic<int32_t>* addr, int32_t expected, const timespec* timeout = nullptr) {
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+inline void futex_wake_all(std::atomic<int32_t>* addr) {
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+} // namespace detail
+} // namespace borrow
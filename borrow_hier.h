@@ -0,0 +1,158 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "borrow.h"
+namespace borrow {
+
+namespace detail {
+
+inline bool hier_within(const void* p, const void* base, size_t size) {
+  const char* c = static_cast<const char*>(p);
+  const char* b = static_cast<const char*>(base);
+  return b != nullptr && c >= b && c < b + size;
+}
+
+} // namespace detail
+
+// Hierarchical borrows: cells nested inside a value that is itself borrowed
+// through a cell (the parent).
+//
+// A child is a ChildCell<U> member of the parent's value. While the parent
+// is only shared-borrowed, children are borrowed independently through
+// their own counters; the parent's Ref is passed in as proof. While the
+// parent is mutably borrowed nobody else can reach the children, so an
+// ExclusiveCap made from the parent's RefMut hands out child access without
+// touching the child counters at all. Exclusivity is transitive: the same
+// capability reaches grandchildren.
+//
+// Child access through a capability is a CheckedPtr. With BORROW_DEBUG it
+// verifies on each dereference that the parent is still mutably borrowed,
+// and on creation that no counted child guard outlived its parent Ref;
+// without it, it is a plain pointer and costs nothing. BORROW_DEBUG also
+// checks that the proof belongs to the child: the ChildCell has to lie in
+// the parent's value (or, through a capability, in a child value already
+// reached through it).
+
+// Proof that a parent is mutably borrowed. Valid while that RefMut is held.
+class ExclusiveCap {
+ public:
+  template <class P>
+  explicit ExclusiveCap(RefMut<P>& parent) : p_cnt_(parent.p_cnt_) {
+    borrow_verify(p_cnt_ != nullptr && *p_cnt_ == -1, "ExclusiveCap needs a held RefMut");
+#if BORROW_DEBUG
+    reach(parent.raw_, sizeof(P));
+#endif
+  }
+  ExclusiveCap(const ExclusiveCap&) = delete;
+
+ private:
+  template <class U>
+  friend class ChildCell;
+  const std::atomic<int32_t>* p_cnt_;
+#if BORROW_DEBUG
+  // Ranges are only added once, so access in a loop does not grow the list.
+  void reach(const void* p, size_t size) const {
+    for (auto& r : reached_) {
+      if (r.first == p && r.second == size) {
+        return;
+      }
+    }
+    if (p != nullptr) {
+      reached_.push_back(std::make_pair(p, size));
+    }
+  }
+  bool reaches(const void* child) const {
+    for (auto& r : reached_) {
+      if (detail::hier_within(child, r.first, r.second)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // the parent's value and the child values handed out so far
+  mutable std::vector<std::pair<const void*, size_t>> reached_;
+#endif
+};
+
+template <class U>
+class ChildCell {
+ public:
+  ChildCell(const ChildCell&) = delete;
+  ChildCell() = default;
+  explicit ChildCell(U* p) : raw_(p) {
+  }
+  ~ChildCell() {
+    borrow_verify(cnt_ == 0, "ChildCell destroyed while borrowed");
+    delete raw_;
+  }
+
+  // Counted borrows, for when the parent is only shared-borrowed. They are
+  // const because the parent's Ref only reaches a const child.
+  template <class P>
+  inline Ref<U> borrow_const(const Ref<P>& parent) const {
+    borrow_verify(parent.p_cnt_ != nullptr, "ChildCell borrow_const without a parent borrow");
+#if BORROW_DEBUG
+    borrow_verify(detail::hier_within(this, parent.raw_, sizeof(P)), "ChildCell borrow_const with another cell's parent borrow");
+#endif
+    auto i = cnt_++;
+    borrow_verify_cnt(i >= 0, "verify failed in ChildCell borrow_const", SharedWhileMut, &cnt_, i);
+    Ref<U> ref;
+    ref.raw_ = raw_;
+    ref.p_cnt_ = &cnt_;
+    return ref;
+  }
+
+  template <class P>
+  inline RefMut<U> borrow_mut(const Ref<P>& parent) const {
+    borrow_verify(parent.p_cnt_ != nullptr, "ChildCell borrow_mut without a parent borrow");
+#if BORROW_DEBUG
+    borrow_verify(detail::hier_within(this, parent.raw_, sizeof(P)), "ChildCell borrow_mut with another cell's parent borrow");
+#endif
+    int32_t expected = 0;
+    bool ok = cnt_.compare_exchange_strong(expected, -1);
+    borrow_verify_cnt(ok, "verify failed in ChildCell borrow_mut", MutWhileBorrowed, &cnt_, expected);
+    RefMut<U> mut;
+    mut.p_cnt_ = &cnt_;
+    mut.raw_ = raw_;
+    return mut;
+  }
+
+  // Uncounted access under the parent's exclusive borrow.
+  inline CheckedPtr<U> borrow_mut(const ExclusiveCap& cap) {
+    return checked<U>(cap);
+  }
+
+  inline CheckedPtr<const U> borrow_const(const ExclusiveCap& cap) {
+    return checked<const U>(cap);
+  }
+
+  // Replaces the value; needs the parent's exclusive borrow.
+  void reset(const ExclusiveCap& cap, U* p) {
+    borrow_verify(*cap.p_cnt_ == -1 && cnt_ == 0, "ChildCell reset while borrowed");
+#if BORROW_DEBUG
+    borrow_verify(cap.reaches(this), "ChildCell reset with another cell's ExclusiveCap");
+#endif
+    delete raw_;
+    raw_ = p;
+  }
+
+ private:
+  template <class V>
+  CheckedPtr<V> checked(const ExclusiveCap& cap) {
+#if BORROW_DEBUG
+    borrow_verify(cap.reaches(this), "ChildCell borrowed with another cell's ExclusiveCap");
+    borrow_verify(cnt_ == 0, "ChildCell guard outlived its parent borrow");
+    cap.reach(raw_, sizeof(U));
+    return CheckedPtr<V>(raw_, cap.p_cnt_, true);
+#else
+    (void)cap;
+    return raw_;
+#endif
+  }
+
+  U* raw_{nullptr};
+  mutable std::atomic<int32_t> cnt_{0};
+};
+
+} // namespace borrow
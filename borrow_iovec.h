@@ -0,0 +1,136 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "borrow.h"
+namespace borrow {
+
+// Scatter/gather batch built from Ref guards. Adding a Ref moves its borrow
+// into the batch and records an iovec pointing straight at the buffer, so
+// nothing is copied and no source buffer can be borrow_mut'ed until the
+// batch is cleared or destroyed. writev()/sendmsg() write the whole batch
+// (retrying on short writes) and then release every borrow.
+//
+// T must expose data() and size() with char-sized elements, e.g.
+// std::vector<char> or std::string.
+template <size_t N = 64>
+class IovecBatch {
+ public:
+  IovecBatch() = default;
+  IovecBatch(const IovecBatch&) = delete;
+  ~IovecBatch() {
+    clear();
+  }
+
+  // Takes over the borrow held by `ref`, which is left empty.
+  // Returns false (and leaves `ref` alone) when the batch is full.
+  template <class T>
+  inline bool add(Ref<T>& ref) {
+    borrow_verify(ref, "adding an empty Ref to IovecBatch");
+    return add(ref, 0, ref->size());
+  }
+
+  // Same as above, for the byte range [offset, offset + len) of the buffer.
+  template <class T>
+  inline bool add(Ref<T>& ref, size_t offset, size_t len) {
+    static_assert(sizeof(*ref.raw_->data()) == 1, "IovecBatch needs a byte buffer");
+    borrow_verify(ref, "adding an empty Ref to IovecBatch");
+    borrow_verify(offset <= ref->size() && len <= ref->size() - offset, "IovecBatch range out of bounds");
+    if (n_ == N) {
+      return false;
+    }
+    iov_[n_].iov_base = const_cast<char*>(reinterpret_cast<const char*>(ref.raw_->data()) + offset);
+    iov_[n_].iov_len = len;
+    cnts_[n_] = ref.p_cnt_;
+    n_++;
+    bytes_ += len;
+    ref.raw_ = nullptr;
+    ref.p_cnt_ = nullptr;
+    return true;
+  }
+
+  template <class T>
+  inline bool add(Ref<T>&& ref) {
+    return add(ref);
+  }
+
+  // Writes every byte of the batch, then releases the borrows.
+  // Returns the bytes written by this call. When the write fails (e.g.
+  // EAGAIN on a nonblocking fd) the batch is advanced past what was written
+  // and keeps its borrows, so calling again resumes where it stopped; the
+  // call returns its partial count with errno set, or -1 if it wrote
+  // nothing. bytes() is then what is still pending.
+  inline ssize_t writev(int fd) {
+    return write_all([fd](const iovec* iov, int cnt) { return ::writev(fd, iov, cnt); });
+  }
+
+  inline ssize_t sendmsg(int fd, int flags = 0) {
+    return write_all([fd, flags](const iovec* iov, int cnt) {
+      msghdr msg{};
+      msg.msg_iov = const_cast<iovec*>(iov);
+      msg.msg_iovlen = cnt;
+      return ::sendmsg(fd, &msg, flags);
+    });
+  }
+
+  // Releases every borrow held by the batch, written or not.
+  inline void clear() {
+    for (size_t i = 0; i < n_; i++) {
+      auto c = (*cnts_[i])--;
+      borrow_verify(c > 0, "error in IovecBatch release");
+    }
+    n_ = 0;
+    first_ = 0;
+    bytes_ = 0;
+  }
+
+  // The part of the batch not written yet.
+  const iovec* iov() const {
+    return iov_ + first_;
+  }
+  size_t count() const {
+    return n_ - first_;
+  }
+  size_t bytes() const {
+    return bytes_;
+  }
+
+ private:
+  template <class W>
+  inline ssize_t write_all(W&& w) {
+    size_t done = 0;
+    while (first_ < n_) {
+      ssize_t r = w(iov_ + first_, static_cast<int>(n_ - first_));
+      if (r < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return done == 0 ? -1 : static_cast<ssize_t>(done);
+      }
+      done += r;
+      bytes_ -= r;
+      size_t adv = static_cast<size_t>(r);
+      while (first_ < n_ && adv >= iov_[first_].iov_len) {
+        adv -= iov_[first_].iov_len;
+        first_++;
+      }
+      if (first_ < n_) {
+        iov_[first_].iov_base = static_cast<char*>(iov_[first_].iov_base) + adv;
+        iov_[first_].iov_len -= adv;
+      }
+    }
+    clear();
+    return static_cast<ssize_t>(done);
+  }
+
+  iovec iov_[N];
+  std::atomic<int32_t>* cnts_[N];
+  size_t n_{0};
+  size_t first_{0};  // iov_[first_] is the first entry not fully written
+  size_t bytes_{0};
+};
+
+} // namespace borrow
@@ -0,0 +1,250 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "borrow.h"
+namespace borrow {
+
+// Read-only view handed out by MmapCell::borrow_const.
+struct MappedView {
+  const char* data{nullptr};
+  size_t size{0};
+};
+
+// The mapping behind MmapCell::borrow_mut. MmapMut only hands it out as
+// const, since the cell unmaps and mprotects exactly this range.
+struct MappedRegion {
+  char* data{nullptr};
+  size_t size{0};
+};
+
+enum class MmapMode {
+  ReadOnly,  // PROT_READ only, borrow_mut is a violation
+  Shared,    // MAP_SHARED, writes reach the file
+  Private,   // MAP_PRIVATE, writes stay in this process
+};
+
+class MmapCell;
+
+// Mutable guard of an MmapCell. Besides the RefMut it remembers which bytes
+// were written so that the release can msync only that range.
+class MmapMut {
+ public:
+  MmapMut() = default;
+  MmapMut(const MmapMut&) = delete;
+  MmapMut(MmapMut&& p) : mut_(std::move(p.mut_)), cell_(p.cell_), lo_(p.lo_), hi_(p.hi_) {
+    p.cell_ = nullptr;
+  }
+  inline ~MmapMut();
+  const MappedRegion* operator->() {
+    return mut_.operator->();
+  }
+  // The mapped bytes, writable while this guard is held.
+  char* data() {
+    return mut_->data;
+  }
+  size_t size() {
+    return mut_->size;
+  }
+  explicit operator bool() const {
+    return static_cast<bool>(mut_);
+  }
+  // Record [offset, offset + len) as written.
+  void mark_dirty(size_t offset, size_t len) {
+    size_t size = mut_->size;
+    borrow_verify(offset <= size && len <= size - offset, "MmapMut::mark_dirty out of range");
+    if (lo_ > offset) {
+      lo_ = offset;
+    }
+    if (hi_ < offset + len) {
+      hi_ = offset + len;
+    }
+  }
+  inline void reset();
+
+ private:
+  friend class MmapCell;
+  RefMut<MappedRegion> mut_;
+  MmapCell* cell_{nullptr};
+  size_t lo_{SIZE_MAX};
+  size_t hi_{0};
+};
+
+// A file mapping with borrow semantics. Outside of a mutable borrow the
+// mapping is PROT_READ, so stray writes through copied pointers fault.
+// borrow_mut switches it to PROT_READ|PROT_WRITE; releasing the guard
+// switches it back and, with sync_on_release, msyncs the dirty range
+// (the whole mapping if nothing was marked). reload() remaps the file and
+// needs the mutable guard, so readers never see a remap mid-read.
+class MmapCell {
+ public:
+  MmapCell() = default;
+  MmapCell(const MmapCell&) = delete;
+  ~MmapCell() {
+    close();
+  }
+
+  // Returns false with errno set on failure.
+  bool open(const char* path, MmapMode mode, bool sync_on_release = false) {
+    borrow_verify(cnt_ == 0, "MmapCell open while borrowed");
+    close();
+    mode_ = mode;
+    sync_ = sync_on_release && mode == MmapMode::Shared;
+    fd_ = ::open(path, mode == MmapMode::Shared ? O_RDWR : O_RDONLY);
+    if (fd_ < 0) {
+      return false;
+    }
+    if (!map()) {
+      int e = errno;
+      close();
+      errno = e;
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    borrow_verify(cnt_ == 0, "MmapCell close while borrowed");
+    unmap();
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  inline Ref<MappedView> borrow_const() {
+    auto i = cnt_++;
+    borrow_verify(i >= 0, "verify failed in MmapCell borrow_const");
+    Ref<MappedView> ref;
+    ref.raw_ = &view_;
+    ref.p_cnt_ = &cnt_;
+    return ref;
+  }
+
+  inline MmapMut borrow_mut() {
+    borrow_verify(mode_ != MmapMode::ReadOnly, "borrow_mut on a read-only MmapCell");
+    int32_t expected = 0;
+    bool ok = cnt_.compare_exchange_strong(expected, -1);
+    borrow_verify(ok, "verify failed in MmapCell borrow_mut");
+    if (region_.size > 0) {
+      int ret = mprotect(region_.data, region_.size, PROT_READ | PROT_WRITE);
+      borrow_verify(ret == 0, "mprotect failed in MmapCell borrow_mut");
+    }
+    MmapMut mut;
+    mut.mut_.p_cnt_ = &cnt_;
+    mut.mut_.raw_ = &region_;
+    mut.cell_ = this;
+    return mut;
+  }
+
+  // Remap after the file changed size or was replaced in place.
+  // Returns false with errno set on failure; the old mapping is gone then.
+  bool reload(MmapMut& guard) {
+    borrow_verify(guard.cell_ == this && guard, "MmapCell reload needs this cell's mutable guard");
+    flush(guard);
+    guard.lo_ = SIZE_MAX;
+    guard.hi_ = 0;
+    unmap();
+    bool ok = map();
+    if (ok && region_.size > 0) {
+      ok = mprotect(region_.data, region_.size, PROT_READ | PROT_WRITE) == 0;
+    }
+    return ok;
+  }
+
+  size_t size() const {
+    return region_.size;
+  }
+  MmapMode mode() const {
+    return mode_;
+  }
+
+ private:
+  friend class MmapMut;
+
+  bool map() {
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      return false;
+    }
+    size_t len = static_cast<size_t>(st.st_size);
+    if (len > 0) {
+      int flags = mode_ == MmapMode::Private ? MAP_PRIVATE : MAP_SHARED;
+      void* p = mmap(nullptr, len, PROT_READ, flags, fd_, 0);
+      if (p == MAP_FAILED) {
+        return false;
+      }
+      region_.data = static_cast<char*>(p);
+    }
+    region_.size = len;
+    view_.data = region_.data;
+    view_.size = len;
+    return true;
+  }
+
+  void unmap() {
+    if (region_.data != nullptr) {
+      munmap(region_.data, region_.size);
+    }
+    region_ = MappedRegion();
+    view_ = MappedView();
+  }
+
+  void flush(MmapMut& guard) {
+    if (!sync_ || region_.size == 0) {
+      return;
+    }
+    size_t lo = guard.hi_ > 0 ? guard.lo_ : 0;
+    size_t hi = guard.hi_ > 0 ? guard.hi_ : region_.size;
+    if (hi > region_.size) {
+      hi = region_.size;
+    }
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    lo &= ~(page - 1);
+    if (lo < hi) {
+      msync(region_.data + lo, hi - lo, MS_SYNC);
+    }
+  }
+
+  // Called with the mutable borrow still held, so readers only get in once
+  // the mapping is read-only (and synced) again.
+  void release_mut(MmapMut& guard) {
+    flush(guard);
+    if (region_.size > 0) {
+      int ret = mprotect(region_.data, region_.size, PROT_READ);
+      borrow_verify(ret == 0, "mprotect failed in MmapCell release");
+    }
+  }
+
+  MappedRegion region_;
+  MappedView view_;
+  std::atomic<int32_t> cnt_{0};
+  int fd_{-1};
+  MmapMode mode_{MmapMode::ReadOnly};
+  bool sync_{false};
+};
+
+inline void MmapMut::reset() {
+  if (cell_ != nullptr && mut_) {
+    cell_->release_mut(*this);
+    mut_.reset();
+  }
+  cell_ = nullptr;
+}
+
+inline MmapMut::~MmapMut() {
+  reset();
+}
+
+inline Ref<MappedView> borrow_const(MmapCell& cell) {
+  return cell.borrow_const();
+}
+
+inline MmapMut borrow_mut(MmapCell& cell) {
+  return cell.borrow_mut();
+}
+
+} // namespace borrow
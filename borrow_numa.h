@@ -0,0 +1,305 @@
+#pragma once
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "borrow.h"
+namespace borrow {
+
+// CPU -> NUMA node map read from /sys/devices/system/node. Falls back to a
+// single node when the topology is not available.
+class NumaTopology {
+ public:
+  // cpu_node[cpu] is the replica index of each CPU, node_ids the kernel
+  // node id of each replica index.
+  NumaTopology(std::vector<int> cpu_node, std::vector<int> node_ids)
+      : cpu_node_(std::move(cpu_node)), node_ids_(std::move(node_ids)) {
+  }
+  NumaTopology() {
+    std::vector<int> nodes = parse_list(read_file("/sys/devices/system/node/online"));
+    for (int n : nodes) {
+      std::string path = "/sys/devices/system/node/node" + std::to_string(n) + "/cpulist";
+      for (int cpu : parse_list(read_file(path.c_str()))) {
+        if (cpu >= static_cast<int>(cpu_node_.size())) {
+          cpu_node_.resize(cpu + 1, -1);
+        }
+        cpu_node_[cpu] = static_cast<int>(node_ids_.size());
+      }
+      node_ids_.push_back(n);
+    }
+    if (node_ids_.empty()) {
+      node_ids_.push_back(0);
+    }
+  }
+
+  static const NumaTopology& get() {
+    static NumaTopology topo;
+    return topo;
+  }
+
+  size_t nodes() const {
+    return node_ids_.size();
+  }
+  // Kernel node id of replica index i.
+  int node_id(size_t i) const {
+    return node_ids_[i];
+  }
+  // Replica index for the CPU this thread runs on.
+  size_t current() const {
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= static_cast<int>(cpu_node_.size()) || cpu_node_[cpu] < 0) {
+      return 0;
+    }
+    return static_cast<size_t>(cpu_node_[cpu]);
+  }
+
+ private:
+  static std::string read_file(const char* path) {
+    std::string s;
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+      return s;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      s.append(buf, n);
+    }
+    fclose(f);
+    return s;
+  }
+
+  // "0-3,8,10-11"
+  static std::vector<int> parse_list(const std::string& s) {
+    std::vector<int> out;
+    size_t i = 0;
+    while (i < s.size()) {
+      if (s[i] < '0' || s[i] > '9') {
+        i++;
+        continue;
+      }
+      int lo = 0;
+      while (i < s.size() && s[i] >= '0' && s[i] <= '9') {
+        lo = lo * 10 + (s[i++] - '0');
+      }
+      int hi = lo;
+      if (i < s.size() && s[i] == '-') {
+        i++;
+        hi = 0;
+        while (i < s.size() && s[i] >= '0' && s[i] <= '9') {
+          hi = hi * 10 + (s[i++] - '0');
+        }
+      }
+      for (int v = lo; v <= hi; v++) {
+        out.push_back(v);
+      }
+    }
+    return out;
+  }
+
+  std::vector<int> cpu_node_;
+  std::vector<int> node_ids_;
+};
+
+namespace detail {
+
+// NumaCell reads held by this thread.
+inline int32_t& numa_reads_held() {
+  static thread_local int32_t held = 0;
+  return held;
+}
+
+} // namespace detail
+
+// Guard over a NumaCell read. Wraps Ref<T> and counts itself as held by the
+// borrowing thread, so it must be released on that thread.
+template <class T>
+class NumaRef {
+ public:
+  NumaRef() = default;
+  NumaRef(const NumaRef&) = delete;
+  explicit NumaRef(Ref<T>&& g) : g_(std::move(g)) {
+    detail::numa_reads_held()++;
+  }
+  NumaRef(NumaRef&& p) : g_(std::move(p.g_)) {
+  }
+  NumaRef& operator=(NumaRef&& p) {
+    if (this != &p) {
+      reset();
+      g_ = std::move(p.g_);
+    }
+    return *this;
+  }
+  ~NumaRef() {
+    reset();
+  }
+  const T* operator->() {
+    return g_.operator->();
+  }
+  const T& operator*() {
+    return *g_;
+  }
+  explicit operator bool() const {
+    return static_cast<bool>(g_);
+  }
+  void reset() {
+    if (g_) {
+      g_.reset();
+      detail::numa_reads_held()--;
+    }
+  }
+
+ private:
+  Ref<T> g_;
+};
+
+// Read-mostly cell with one replica of T, and of its borrow counter, per
+// NUMA node. borrow_const() borrows the replica of the caller's node, so
+// readers only touch node-local memory. borrow_mut(op) is node-replication
+// style: the mutation is an operation, applied to every replica. The writer
+// first flags every replica so that no new reader enters, waits for the
+// current readers to leave, and only then applies the operation under all
+// the mutable borrows at once, so no reader can see the new value on one
+// node and the old one on another afterwards. Readers on every node wait
+// for the duration of an update, and a steady stream of readers cannot
+// starve the writer.
+//
+// A thread that already holds a read is let past the flag, since the writer
+// waits for that read; it only waits while the operation runs. The writer
+// takes the replicas all at once: if such a read slipped in, it gives back
+// the ones it took and waits again.
+//
+// Operations must be deterministic so that all replicas stay equal.
+// Replica memory is bound to its node with mbind(); memory T allocates
+// itself is placed by the kernel's default policy.
+template <class T>
+class NumaCell {
+  // Set in a replica's counter by a waiting writer; readers do not enter.
+  static const int32_t kWriterWaiting = 1 << 30;
+
+  struct alignas(BORROW_CACHE_LINE_SIZE) Replica {
+    explicit Replica(const T& v) : value(v) {
+    }
+    T value;
+    std::atomic<int32_t> cnt_{0};
+  };
+
+ public:
+  using Op = std::function<void(T&)>;
+
+  NumaCell(const NumaCell&) = delete;
+  explicit NumaCell(const T& init = T(), const NumaTopology& topo = NumaTopology::get()) : topo_(topo) {
+    for (size_t i = 0; i < topo_.nodes(); i++) {
+      replicas_.push_back(make_replica(init, topo_.node_id(i)));
+    }
+  }
+  ~NumaCell() {
+    for (Replica* r : replicas_) {
+      borrow_verify(r->cnt_ == 0, "NumaCell destroyed while borrowed");
+      r->~Replica();
+      munmap(r, replica_bytes());
+    }
+  }
+
+  inline NumaRef<T> borrow_const() {
+    return borrow_const(topo_.current());
+  }
+
+  // Borrows replica i, e.g. for a thread that knows its node.
+  inline NumaRef<T> borrow_const(size_t i) {
+    borrow_verify(i < replicas_.size(), "NumaCell replica index out of range");
+    Replica* r = replicas_[i];
+    bool nested = detail::numa_reads_held() > 0;
+    int32_t c = r->cnt_.load();
+    for (;;) {
+      if (c >= 0 && (nested || (c & kWriterWaiting) == 0)) {
+        if (r->cnt_.compare_exchange_weak(c, c + 1)) {
+          break;
+        }
+        continue;
+      }
+      std::this_thread::yield();  // update pending or running
+      c = r->cnt_.load();
+    }
+    Ref<T> ref;
+    ref.raw_ = &r->value;
+    ref.p_cnt_ = &r->cnt_;
+    return NumaRef<T>(std::move(ref));
+  }
+
+  // Applies op to every replica once all of them are mutably borrowed;
+  // writers are serialized. Returns the number of operations applied so far.
+  uint64_t borrow_mut(const Op& op) {
+    std::lock_guard<std::mutex> lock(write_mu_);
+    for (Replica* r : replicas_) {
+      int32_t c = r->cnt_.fetch_or(kWriterWaiting);
+      borrow_verify(c >= 0, "NumaCell replica mutably borrowed outside borrow_mut");
+    }
+    size_t taken = 0;
+    while (taken < replicas_.size()) {
+      for (taken = 0; taken < replicas_.size(); taken++) {
+        int32_t expected = kWriterWaiting;
+        if (!replicas_[taken]->cnt_.compare_exchange_strong(expected, -1)) {
+          break;
+        }
+      }
+      if (taken < replicas_.size()) {
+        // readers still inside; holding the others could block them
+        for (size_t i = 0; i < taken; i++) {
+          replicas_[i]->cnt_.store(kWriterWaiting);
+        }
+        std::this_thread::yield();
+      }
+    }
+    std::vector<RefMut<T>> muts(replicas_.size());
+    for (size_t i = 0; i < replicas_.size(); i++) {
+      muts[i].p_cnt_ = &replicas_[i]->cnt_;
+      muts[i].raw_ = &replicas_[i]->value;
+    }
+    for (RefMut<T>& mut : muts) {
+      op(*mut);
+    }
+    return ++ops_;
+  }
+
+  size_t replicas() const {
+    return replicas_.size();
+  }
+
+ private:
+  static size_t replica_bytes() {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (sizeof(Replica) + page - 1) / page * page;
+  }
+
+  static Replica* make_replica(const T& init, int node) {
+    void* p = mmap(nullptr, replica_bytes(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    borrow_verify(p != MAP_FAILED, "NumaCell failed to allocate a replica");
+    if (node >= 0 && node < 64) {
+      unsigned long mask = 1UL << node;
+      // best effort; without NUMA support the pages stay where they are
+      syscall(SYS_mbind, p, replica_bytes(), MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0);
+    }
+    return new (p) Replica(init);
+  }
+
+  const NumaTopology& topo_;
+  std::vector<Replica*> replicas_;
+  std::mutex write_mu_;
+  uint64_t ops_{0};
+};
+
+template <typename T>
+inline NumaRef<T> borrow_const(NumaCell<T>& cell) {
+  return cell.borrow_const();
+}
+
+} // namespace borrow
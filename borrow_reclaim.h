@@ -0,0 +1,252 @@
+#pragma once
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include "borrow.h"
+namespace borrow {
+
+template <class T>
+class ReclaimCell;
+
+namespace detail {
+
+// Hazard slots: a thread publishes the version it is about to borrow, so
+// that the version is not deleted between loading the cell's current
+// version and taking its counter. One slot per thread, on its own cache
+// line; slots of exited threads are reused, never freed.
+struct alignas(BORROW_CACHE_LINE_SIZE) HazardSlot {
+  std::atomic<const void*> ptr{nullptr};
+  std::atomic<bool> used{true};
+  HazardSlot* next{nullptr};
+};
+
+template <class Dummy>
+struct HazardListHolder {
+  static std::atomic<HazardSlot*> head;
+};
+template <class Dummy>
+std::atomic<HazardSlot*> HazardListHolder<Dummy>::head{nullptr};
+
+inline HazardSlot* claim_hazard_slot() {
+  std::atomic<HazardSlot*>& head = HazardListHolder<void>::head;
+  for (HazardSlot* s = head.load(); s != nullptr; s = s->next) {
+    bool expected = false;
+    if (!s->used.load(std::memory_order_relaxed) && s->used.compare_exchange_strong(expected, true)) {
+      return s;
+    }
+  }
+  void* p = nullptr;
+  bool ok = posix_memalign(&p, BORROW_CACHE_LINE_SIZE, sizeof(HazardSlot)) == 0;
+  borrow_verify(ok, "failed to allocate a hazard slot");
+  HazardSlot* s = new (p) HazardSlot();
+  HazardSlot* first = head.load();
+  do {
+    s->next = first;
+  } while (!head.compare_exchange_weak(first, s));
+  return s;
+}
+
+struct HazardSlotOwner {
+  HazardSlot* slot{claim_hazard_slot()};
+  ~HazardSlotOwner() {
+    slot->used.store(false, std::memory_order_release);
+  }
+};
+
+inline HazardSlot& hazard_slot() {
+  static thread_local HazardSlotOwner owner;
+  return *owner.slot;
+}
+
+// Waits until no thread publishes p. Publishers of a retired version move on
+// within a few instructions.
+inline void wait_unhazarded(const void* p) {
+  for (HazardSlot* s = HazardListHolder<void>::head.load(); s != nullptr; s = s->next) {
+    while (s->ptr.load() == p) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Version state: reader count in the low bits, plus kReclaimWriter per
+// writer and kReclaimRetired once reset() replaced the version. Conflicting
+// borrows still add their share, so every release can undo its own; nobody
+// adds to a retired version.
+static constexpr int32_t kReclaimWriter = 1 << 20;
+static constexpr int32_t kReclaimRetired = 1 << 30;
+
+template <class T>
+struct ReclaimVersion {
+  explicit ReclaimVersion(T* p) : raw_(p) {
+  }
+  ~ReclaimVersion() {
+    delete raw_;
+  }
+  // Called by whoever left the version retired without holders: the
+  // retiring reset() or the last guard.
+  void destroy() {
+    wait_unhazarded(this);
+    delete this;
+  }
+  T* raw_;
+  std::atomic<int32_t> state_{0};
+};
+
+} // namespace detail
+
+// Guard over a ReclaimCell borrow. It holds its version, so it may outlive
+// reset() and the cell itself; the release that leaves a retired version
+// without holders deletes it.
+template <class T, bool Mut>
+class ReclaimGuard {
+ public:
+  ReclaimGuard() = default;
+  ReclaimGuard(const ReclaimGuard&) = delete;
+  ReclaimGuard(ReclaimGuard&& p) : v_(p.v_) {
+    p.v_ = nullptr;
+  }
+  ReclaimGuard& operator=(ReclaimGuard&& p) {
+    if (this != &p) {
+      reset();
+      std::swap(v_, p.v_);
+    }
+    return *this;
+  }
+  ~ReclaimGuard() {
+    reset();
+  }
+  typename std::conditional<Mut, T*, const T*>::type operator->() {
+    return v_->raw_;
+  }
+  typename std::conditional<Mut, T&, const T&>::type operator*() {
+    return *v_->raw_;
+  }
+  explicit operator bool() const {
+    return v_ != nullptr;
+  }
+  void reset() {
+    if (v_ == nullptr) {
+      return;
+    }
+    const int32_t held = Mut ? detail::kReclaimWriter : 1;
+    auto i = v_->state_.fetch_sub(held);
+    auto holders = i & ~detail::kReclaimRetired;
+    borrow_verify(Mut ? holders == held : holders > 0 && holders < detail::kReclaimWriter,
+                  "error in ReclaimCell guard release");
+    if (i == (detail::kReclaimRetired | held)) {
+      // last holder of a retired version; nobody can take it any more
+      v_->destroy();
+    }
+    v_ = nullptr;
+  }
+
+ private:
+  friend class ReclaimCell<T>;
+  detail::ReclaimVersion<T>* v_{nullptr};
+};
+
+template <class T>
+using ReclaimRef = ReclaimGuard<T, false>;
+template <class T>
+using ReclaimRefMut = ReclaimGuard<T, true>;
+
+// Thread-safe cell whose reset() never waits for (or trips over) readers.
+//
+// Every value lives in its own version with its own borrow counter; guards
+// hold that version. reset(p) installs a new version for all future borrows
+// right away and retires the old one, which is deleted by whichever of
+// reset() and the old version's guards finishes last.
+//
+// Acquiring a borrow loads the current version and takes its counter; a
+// per-thread hazard slot covers that short window instead of a counter
+// shared by all borrowers, and a version retired in between is skipped for
+// its successor.
+template <class T>
+class ReclaimCell {
+  typedef detail::ReclaimVersion<T> Version;
+
+ public:
+  ReclaimCell(const ReclaimCell&) = delete;
+  ReclaimCell() : current_(new Version(nullptr)) {
+  }
+  explicit ReclaimCell(T* p) : current_(new Version(p)) {
+  }
+  // Guards of retired versions may outlive the cell.
+  ~ReclaimCell() {
+    Version* v = current_.load();
+    borrow_verify(v->state_ == 0, "ReclaimCell destroyed while borrowed");
+    retire(v);
+  }
+
+  inline ReclaimRef<T> borrow_const() {
+    ReclaimRef<T> ref;
+    int32_t i = acquire(1, ref.v_);
+    borrow_verify(i < detail::kReclaimWriter, "verify failed in ReclaimCell borrow_const");
+    return ref;
+  }
+
+  // Mutates the current version in place; readers of retired versions are
+  // not affected.
+  inline ReclaimRefMut<T> borrow_mut() {
+    ReclaimRefMut<T> mut;
+    int32_t i = acquire(detail::kReclaimWriter, mut.v_);
+    borrow_verify(i == 0, "verify failed in ReclaimCell borrow_mut");
+    return mut;
+  }
+
+  // Installs p for future borrows. The old value is deleted now if nobody
+  // borrows it, otherwise when its last guard is released.
+  void reset(T* p) {
+    retire(current_.exchange(new Version(p)));
+  }
+
+  void reset() {
+    reset(nullptr);
+  }
+
+ private:
+  // Adds n to the current version's state and returns the state before.
+  int32_t acquire(int32_t n, Version*& out) {
+    detail::HazardSlot& hazard = detail::hazard_slot();
+    for (;;) {
+      Version* v = current_.load();
+      hazard.ptr.store(v);
+      if (current_.load() != v) {
+        continue;
+      }
+      // v cannot be deleted before the slot is cleared; it can be retired
+      int32_t s = v->state_.load();
+      while ((s & detail::kReclaimRetired) == 0 && !v->state_.compare_exchange_weak(s, s + n)) {
+      }
+      if ((s & detail::kReclaimRetired) != 0) {
+        continue;
+      }
+      hazard.ptr.store(nullptr, std::memory_order_release);
+      out = v;
+      return s;
+    }
+  }
+
+  // Exactly one of this and the guards' releases sees the version retired
+  // without holders, and deletes it.
+  static void retire(Version* v) {
+    if (v->state_.fetch_add(detail::kReclaimRetired) == 0) {
+      v->destroy();
+    }
+  }
+
+  std::atomic<Version*> current_;
+};
+
+template <typename T>
+inline ReclaimRef<T> borrow_const(ReclaimCell<T>& cell) {
+  return cell.borrow_const();
+}
+
+template <typename T>
+inline ReclaimRefMut<T> borrow_mut(ReclaimCell<T>& cell) {
+  return cell.borrow_mut();
+}
+
+} // namespace borrow
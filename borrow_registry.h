@@ -0,0 +1,160 @@
+#pragma once
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include "borrow.h"
+#ifndef BORROW_REGISTRY
+#error "borrow_registry.h needs -DBORROW_REGISTRY"
+#endif
+namespace borrow {
+
+// Dump of the live-cell registry: one line per currently borrowed RefCell
+// with its counter value (n readers, -1 writer), the thread id and site of
+// its last borrow, e.g.
+//
+//   borrow: cell 0x55d0c8a0 cnt -1 thread 4711 site 0x55d0c3f1a2
+//
+// followed by a summary line. Sites are PCs; symbolize them with
+// `addr2line -f -i -e <binary>` (after subtracting the load address for PIE).
+//
+// The writer only uses write(2) and a stack buffer, so it is
+// async-signal-safe and can run from install_registry_signal()'s handler
+// while the process is stalled. It reads the cells without synchronizing
+// with their destruction, so a cell destroyed during the dump may show up
+// with stale values.
+//
+// BORROW_REGISTRY adds a member to RefCell, so it has to be set for every
+// translation unit, i.e. on the command line.
+
+namespace detail {
+
+struct DumpBuffer {
+  explicit DumpBuffer(int fd) : fd_(fd) {
+  }
+  ~DumpBuffer() {
+    flush();
+  }
+  void str(const char* s) {
+    while (*s != '\0') {
+      put(*s++);
+    }
+  }
+  void dec(int64_t v) {
+    char tmp[24];
+    int n = 0;
+    uint64_t u = v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+    do {
+      tmp[n++] = static_cast<char>('0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    if (v < 0) {
+      put('-');
+    }
+    while (n > 0) {
+      put(tmp[--n]);
+    }
+  }
+  void hex(const void* p) {
+    static const char digits[] = "0123456789abcdef";
+    uintptr_t u = reinterpret_cast<uintptr_t>(p);
+    char tmp[2 * sizeof(u)];
+    int n = 0;
+    do {
+      tmp[n++] = digits[u & 0xf];
+      u >>= 4;
+    } while (u != 0);
+    str("0x");
+    while (n > 0) {
+      put(tmp[--n]);
+    }
+  }
+  void put(char c) {
+    if (len_ == sizeof(buf_)) {
+      flush();
+    }
+    buf_[len_++] = c;
+  }
+  void flush() {
+    size_t off = 0;
+    while (off < len_) {
+      ssize_t n = write(fd_, buf_ + off, len_ - off);
+      if (n <= 0) {
+        break;
+      }
+      off += static_cast<size_t>(n);
+    }
+    len_ = 0;
+  }
+
+  int fd_;
+  size_t len_{0};
+  char buf_[512];
+};
+
+template <class Dummy>
+struct RegistrySignal {
+  static std::atomic<int> fd;
+};
+template <class Dummy>
+std::atomic<int> RegistrySignal<Dummy>::fd{STDERR_FILENO};
+
+} // namespace detail
+
+// Writes the borrowed cells to fd. Returns the number listed.
+inline size_t dump_live_cells(int fd = STDERR_FILENO) {
+  CellRegistry& reg = cell_registry();
+  detail::DumpBuffer out(fd);
+  uint32_t high = reg.high.load(std::memory_order_acquire);
+  if (high > BORROW_REGISTRY_SIZE) {
+    high = BORROW_REGISTRY_SIZE;
+  }
+  size_t live = 0;
+  size_t borrowed = 0;
+  for (uint32_t i = 0; i < high; i++) {
+    RegistryNode* node = reg.nodes[i].load(std::memory_order_acquire);
+    if (node == nullptr) {
+      continue;
+    }
+    live++;
+    int32_t cnt = node->p_cnt_->load(std::memory_order_relaxed);
+    if (cnt == 0) {
+      continue;
+    }
+    borrowed++;
+    out.str("borrow: cell ");
+    out.hex(node->p_cnt_);
+    out.str(" cnt ");
+    out.dec(cnt);
+    out.str(" thread ");
+    out.dec(node->holder_.load(std::memory_order_relaxed));
+    out.str(" site ");
+    out.hex(node->site_.load(std::memory_order_relaxed));
+    out.put('\n');
+  }
+  out.str("borrow: ");
+  out.dec(static_cast<int64_t>(borrowed));
+  out.str(" of ");
+  out.dec(static_cast<int64_t>(live));
+  out.str(" live cells borrowed, ");
+  out.dec(static_cast<int64_t>(reg.unregistered.load(std::memory_order_relaxed)));
+  out.str(" not registered\n");
+  return borrowed;
+}
+
+// Dumps to fd whenever sig arrives. Returns false if sigaction failed.
+inline bool install_registry_signal(int sig = SIGUSR1, int fd = STDERR_FILENO) {
+  detail::RegistrySignal<void>::fd.store(fd);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = [](int) {
+    int saved = errno;
+    dump_live_cells(detail::RegistrySignal<void>::fd.load());
+    errno = saved;
+  };
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  return sigaction(sig, &sa, nullptr) == 0;
+}
+
+} // namespace borrow
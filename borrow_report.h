@@ -0,0 +1,166 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <execinfo.h>
+#include "borrow.h"
+#ifndef BORROW_DEFERRED_REPORT
+#error "borrow_report.h needs -DBORROW_DEFERRED_REPORT (or -DBORROW_REALTIME)"
+#endif
+namespace borrow {
+
+// Background reporter for deferred violation records.
+//
+// Every drain pops all records and folds them into per-site aggregates,
+// keyed by the failing PC and the kind. The first record of a site is
+// printed with its symbolized stack; later ones only bump the site's
+// count, and each pass prints one line per site that saw new records plus
+// the number of records the ring had to drop. A violation storm therefore
+// costs one line per site per interval instead of one stack per violation.
+//
+// BORROW_DEFERRED_REPORT changes what borrow.h compiles to, so it has to be
+// set for every translation unit, i.e. on the command line.
+class ViolationReporter {
+ public:
+  struct Site {
+    ViolationKind kind;
+    const char* msg;
+    uint64_t count{0};
+    uint64_t printed{0};  // count at the last report
+    uint64_t first_ns{0};
+    uint64_t last_ns{0};
+    const void* last_cell{nullptr};
+    int32_t last_cnt{0};
+  };
+
+  explicit ViolationReporter(FILE* out = stderr,
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(1000))
+      : out_(out), interval_(interval) {
+  }
+  ViolationReporter(const ViolationReporter&) = delete;
+  ~ViolationReporter() {
+    stop();
+  }
+
+  void start() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (running_) {
+      return;
+    }
+    running_ = true;
+    thread_ = std::thread([this] { run(); });
+  }
+
+  // Stops the thread after a final drain.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (!running_) {
+        return;
+      }
+      running_ = false;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // One reporting pass; also usable without the thread. Returns the number
+  // of records drained.
+  size_t drain() {
+    std::lock_guard<std::mutex> lock(sites_mu_);
+    size_t n = 0;
+    ViolationRecord rec;
+    while (pop_violation(rec)) {
+      n++;
+      Site& s = sites_[std::make_pair(rec.pcs[0], static_cast<int>(rec.kind))];
+      if (s.count == 0) {
+        s.kind = rec.kind;
+        s.msg = rec.msg;
+        s.first_ns = rec.ts_ns;
+        print_first(rec);
+        s.printed = 1;
+      }
+      s.count++;
+      s.last_ns = rec.ts_ns;
+      s.last_cell = rec.cell;
+      s.last_cnt = rec.cnt;
+    }
+    for (auto& kv : sites_) {
+      Site& s = kv.second;
+      if (s.count > s.printed) {
+        fprintf(out_, "borrow violation at %p (%s): %s, +%llu (total %llu), last cell %p cnt %d\n",
+                kv.first.first, kind_name(s.kind), s.msg, static_cast<unsigned long long>(s.count - s.printed),
+                static_cast<unsigned long long>(s.count), s.last_cell, s.last_cnt);
+        s.printed = s.count;
+      }
+    }
+    uint64_t dropped = dropped_violations();
+    if (dropped > dropped_seen_) {
+      fprintf(out_, "borrow violation log dropped %llu records\n",
+              static_cast<unsigned long long>(dropped - dropped_seen_));
+      dropped_seen_ = dropped;
+    }
+    fflush(out_);
+    return n;
+  }
+
+  // Snapshot of the aggregates, keyed by (failing PC, kind).
+  std::map<std::pair<void*, int>, Site> sites() {
+    std::lock_guard<std::mutex> lock(sites_mu_);
+    return sites_;
+  }
+
+  static const char* kind_name(ViolationKind k) {
+    switch (k) {
+      case ViolationKind::SharedWhileMut:
+        return "borrow_const while mutably borrowed";
+      case ViolationKind::MutWhileBorrowed:
+        return "borrow_mut while borrowed";
+      case ViolationKind::BadRelease:
+        return "bad guard release";
+      case ViolationKind::ResetWhileBorrowed:
+        return "reset while borrowed";
+      default:
+        return "other";
+    }
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (running_) {
+      cv_.wait_for(lock, interval_);
+      lock.unlock();
+      drain();
+      lock.lock();
+    }
+    lock.unlock();
+    drain();
+  }
+
+  void print_first(const ViolationRecord& rec) {
+    fprintf(out_, "borrow violation (%s): %s, cell %p cnt %d\n", kind_name(rec.kind), rec.msg, rec.cell, rec.cnt);
+    char** symbols = backtrace_symbols(const_cast<void* const*>(rec.pcs), rec.npcs);
+    for (int i = 0; i < rec.npcs; i++) {
+      fprintf(out_, "  #%d %s\n", i, symbols != nullptr ? symbols[i] : "?");
+    }
+    free(symbols);
+  }
+
+  FILE* out_;
+  std::chrono::milliseconds interval_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool running_{false};
+  std::thread thread_;
+  std::mutex sites_mu_;
+  std::map<std::pair<void*, int>, Site> sites_;
+  uint64_t dropped_seen_{0};
+};
+
+} // namespace borrow
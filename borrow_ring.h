@@ -0,0 +1,143 @@
+#pragma once
+#include <cstddef>
+#include "borrow.h"
+namespace borrow {
+
+// Single-producer/single-consumer ring whose slots are leased out as borrow
+// guards. The producer gets a RefMut on the next free slot, the consumer gets
+// a Ref on the next committed slot; dropping the guard is the commit/release.
+//
+// A slot only changes hands once its counter is back to 0, so a slot can not
+// be reused while any lease (or a copy of a consumer Ref) on it is alive.
+// Index publication is batched: the producer publishes its tail every
+// `publish_batch` commits, the consumer its head every `publish_batch`
+// releases. A dropped guard is only noticed by that side's next call, so
+// call flush_produce()/flush_consume() to publish a partial batch, including
+// the last lease.
+template <class T, size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+  struct alignas(BORROW_CACHE_LINE_SIZE) Slot {
+    T value{};
+    std::atomic<int32_t> cnt_{0};
+  };
+
+ public:
+  SpscRing(const SpscRing&) = delete;
+  explicit SpscRing(size_t publish_batch = 1) : batch_(publish_batch == 0 ? 1 : publish_batch) {
+    borrow_verify(batch_ <= N, "publish batch larger than SpscRing");
+  }
+
+  // Producer side. Returns an empty RefMut if the ring is full.
+  inline RefMut<T> try_produce() {
+    commit_produced();
+    borrow_verify(!prod_.leased, "SpscRing already has a producer lease");
+    if (prod_.pos - prod_.cached_peer == N) {
+      prod_.cached_peer = head_.load(std::memory_order_acquire);
+      if (prod_.pos - prod_.cached_peer == N) {
+        return RefMut<T>();
+      }
+    }
+    Slot& s = slots_[prod_.pos & (N - 1)];
+    auto i = s.cnt_--;
+    borrow_verify(i == 0, "SpscRing slot reused while still borrowed");
+    prod_.leased = true;
+    RefMut<T> mut;
+    mut.p_cnt_ = &s.cnt_;
+    mut.raw_ = &s.value;
+    return mut;
+  }
+
+  // Consumer side. Returns an empty Ref if nothing is committed.
+  inline Ref<T> try_consume() {
+    release_consumed();
+    borrow_verify(!cons_.leased, "SpscRing already has a consumer lease");
+    if (cons_.pos == cons_.cached_peer) {
+      cons_.cached_peer = tail_.load(std::memory_order_acquire);
+      if (cons_.pos == cons_.cached_peer) {
+        return Ref<T>();
+      }
+    }
+    Slot& s = slots_[cons_.pos & (N - 1)];
+    auto i = s.cnt_++;
+    borrow_verify(i == 0, "SpscRing slot consumed while still borrowed");
+    cons_.leased = true;
+    Ref<T> ref;
+    ref.raw_ = &s.value;
+    ref.p_cnt_ = &s.cnt_;
+    return ref;
+  }
+
+  // Publish whatever the producer has committed so far.
+  inline void flush_produce() {
+    commit_produced();
+    if (prod_.pos != prod_.published) {
+      prod_.published = prod_.pos;
+      tail_.store(prod_.pos, std::memory_order_release);
+    }
+  }
+
+  // Publish whatever the consumer has released so far.
+  inline void flush_consume() {
+    release_consumed();
+    if (cons_.pos != cons_.published) {
+      cons_.published = cons_.pos;
+      head_.store(cons_.pos, std::memory_order_release);
+    }
+  }
+
+  static constexpr size_t capacity() {
+    return N;
+  }
+
+ private:
+  // Per-side state, each on its own cache line next to the index it publishes.
+  struct Side {
+    size_t pos{0};          // next slot to lease
+    size_t published{0};    // last value stored into the shared index
+    size_t cached_peer{0};  // last value read from the other side's index
+    bool leased{false};
+  };
+
+  inline void commit_produced() {
+    if (!prod_.leased) {
+      return;
+    }
+    if (slots_[prod_.pos & (N - 1)].cnt_.load(std::memory_order_acquire) != 0) {
+      return;  // lease still alive
+    }
+    prod_.leased = false;
+    prod_.pos++;
+    if (prod_.pos - prod_.published >= batch_) {
+      prod_.published = prod_.pos;
+      tail_.store(prod_.pos, std::memory_order_release);
+    }
+  }
+
+  inline void release_consumed() {
+    if (!cons_.leased) {
+      return;
+    }
+    if (slots_[cons_.pos & (N - 1)].cnt_.load(std::memory_order_acquire) != 0) {
+      return;  // lease (or a copy of it) still alive
+    }
+    cons_.leased = false;
+    cons_.pos++;
+    if (cons_.pos - cons_.published >= batch_) {
+      cons_.published = cons_.pos;
+      head_.store(cons_.pos, std::memory_order_release);
+    }
+  }
+
+  const size_t batch_;
+  // consumer-owned line
+  alignas(BORROW_CACHE_LINE_SIZE) std::atomic<size_t> head_{0};
+  Side cons_;
+  // producer-owned line
+  alignas(BORROW_CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};
+  Side prod_;
+  Slot slots_[N];
+};
+
+} // namespace borrow
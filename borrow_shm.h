@@ -0,0 +1,505 @@
+#pragma once
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "borrow.h"
+#include "borrow_futex.h"
+namespace borrow {
+
+// Borrow cells living in a POSIX shared memory segment, usable by several
+// cooperating processes on one host.
+//
+// The segment holds a header (the writer word, a waiter count, per-process
+// reader slots) followed by the payload at a fixed offset; nothing in it is
+// a pointer, so every process may map it at a different address. Readers
+// count themselves only in their process's slot, and then look at the
+// writer word (0 free, -1 one writer), backing off if a writer is in. A
+// writer takes the writer word and then looks at the slots, backing off if
+// a reader is in; one of the two always sees the other. borrow_const/
+// borrow_mut check like RefCell does; wait_const/wait_mut block on a
+// process-shared futex on the writer word instead.
+//
+// Crash robustness: processes are identified by their PID and start time,
+// so a reused PID does not pass for a dead holder. A writer first claims the
+// owner word, then takes the writer word, and bumps the generation. Waiters
+// periodically check whether the holders are still alive (kill(pid, 0) and
+// /proc/<pid>/stat):
+//  - a dead reader's slot is cleared, which drops exactly its reads;
+//  - a dead writer that still holds the writer word leaves the cell
+//    poisoned.
+// A poisoned cell refuses every borrow (wait_* return an empty guard,
+// borrow_* fail borrow_verify) until someone calls recover(), which hands
+// the dead writer's borrow to the caller so it can repair the payload.
+// Without /proc only kill() is checked, and a reused PID keeps its
+// predecessor's borrows.
+
+namespace detail {
+
+// Start time of a process in clock ticks since boot (field 22 of
+// /proc/<pid>/stat), 0 if unknown.
+inline uint64_t proc_start_time(int32_t pid) {
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  char buf[1024];
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  ::close(fd);
+  if (n <= 0) {
+    return 0;
+  }
+  buf[n] = 0;
+  // the command name may contain spaces and parentheses; fields count from
+  // the last ')', which ends field 2
+  const char* p = strrchr(buf, ')');
+  for (int field = 2; p != nullptr && field < 22; field++) {
+    p = strchr(p + 1, ' ');
+  }
+  return p == nullptr ? 0 : strtoull(p + 1, nullptr, 10);
+}
+
+// A process as recorded in the segment: the PID in the low half, the low
+// half of its start time in the high half.
+inline uint64_t shm_process_id(int32_t pid) {
+  return proc_start_time(pid) << 32 | static_cast<uint32_t>(pid);
+}
+
+inline bool shm_process_dead(uint64_t id) {
+  int32_t pid = static_cast<int32_t>(id);
+  if (pid <= 0) {
+    return false;
+  }
+  if (kill(pid, 0) != 0 && errno == ESRCH) {
+    return true;
+  }
+  // alive, but maybe a new process under a reused PID
+  uint32_t start = static_cast<uint32_t>(id >> 32);
+  uint32_t now = static_cast<uint32_t>(proc_start_time(pid));
+  return start != 0 && now != 0 && now != start;
+}
+
+} // namespace detail
+
+struct ShmReaderSlot {
+  std::atomic<uint64_t> owner;  // process id, 0 if free
+  std::atomic<int32_t> count;   // reads that process holds
+};
+
+struct ShmHeader {
+  static constexpr uint64_t kMagic = 0x6c6c6563776f7262ULL;  // "borrcell"
+  static constexpr uint32_t kVersion = 3;
+  static constexpr int kReaderSlots = 64;
+
+  std::atomic<uint64_t> magic;
+  uint32_t version;
+  uint32_t payload_offset;
+  uint64_t payload_size;
+  std::atomic<int32_t> cnt_;           // writer word: -1 held, 0 free
+  std::atomic<uint32_t> waiters_;
+  std::atomic<uint64_t> owner_;        // writer (or writer-to-be), 0 if none
+  std::atomic<uint32_t> generation_;   // bumped on every mutable borrow
+  std::atomic<uint32_t> poisoned_;
+  ShmReaderSlot readers_[kReaderSlots];
+};
+
+static_assert(std::is_standard_layout<ShmHeader>::value, "ShmHeader must be standard layout");
+static_assert(sizeof(std::atomic<int32_t>) == sizeof(int32_t) && ATOMIC_INT_LOCK_FREE == 2,
+              "the futex word must be a plain lock-free int");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "process ids must be lock-free in shared memory");
+
+namespace detail {
+
+template <class G>
+struct ShmIsRead : std::false_type {};
+template <class T>
+struct ShmIsRead<Ref<T>> : std::true_type {};
+
+} // namespace detail
+
+// Guard over a shared-memory borrow. Wraps Ref<T> (counting in the reader
+// slot) or RefMut<T>, clears the owner word of a writer and wakes blocked
+// processes on release.
+template <class G>
+class ShmGuard {
+ public:
+  ShmGuard() = default;
+  ShmGuard(const ShmGuard&) = delete;
+  ShmGuard(G&& g, ShmHeader* hdr, std::atomic<int32_t>* live) : g_(std::move(g)), hdr_(hdr), live_(live) {
+    live_->fetch_add(1);
+  }
+  ShmGuard(ShmGuard&& p) : g_(std::move(p.g_)), hdr_(p.hdr_), live_(p.live_) {
+    p.hdr_ = nullptr;
+    p.live_ = nullptr;
+  }
+  ~ShmGuard() {
+    reset();
+  }
+  auto operator->() -> decltype(std::declval<G&>().operator->()) {
+    return g_.operator->();
+  }
+  auto operator*() -> decltype(*std::declval<G&>()) {
+    return *g_;
+  }
+  explicit operator bool() const {
+    return static_cast<bool>(g_);
+  }
+  void reset() {
+    if (g_) {
+      g_.reset();
+      if (!detail::ShmIsRead<G>::value) {
+        // the owner word keeps other writers out until it is cleared
+        hdr_->owner_.store(0);
+      }
+      if (hdr_->waiters_.load() > 0) {
+        detail::futex_wake_all(&hdr_->cnt_);
+      }
+      live_->fetch_sub(1);
+    }
+    hdr_ = nullptr;
+    live_ = nullptr;
+  }
+
+ private:
+  G g_;
+  ShmHeader* hdr_{nullptr};
+  std::atomic<int32_t>* live_{nullptr};  // the ShmCell's guard count
+};
+
+template <class T>
+using ShmRef = ShmGuard<Ref<T>>;
+template <class T>
+using ShmRefMut = ShmGuard<RefMut<T>>;
+
+// T is copied bytewise between processes, so it must not hold pointers.
+// A ShmCell object belongs to the process that created/opened it; open the
+// segment again after fork().
+template <class T>
+class ShmCell {
+  static_assert(std::is_trivially_copyable<T>::value, "ShmCell payload must be trivially copyable");
+
+ public:
+  static constexpr uint32_t kPayloadOffset =
+      (sizeof(ShmHeader) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+  ShmCell() = default;
+  ShmCell(const ShmCell&) = delete;
+  ~ShmCell() {
+    close();
+  }
+
+  // Creates a new segment and constructs T in it. Fails with EEXIST if the
+  // segment already exists. Returns false with errno set on failure.
+  template <class... Args>
+  bool create(const char* name, Args&&... args) {
+    close();
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+      return false;
+    }
+    if (ftruncate(fd, segment_size()) != 0 || !map(fd)) {
+      int e = errno;
+      ::close(fd);
+      shm_unlink(name);
+      errno = e;
+      return false;
+    }
+    ::close(fd);
+    // ftruncate zero-fills, which is the initial state of every atomic.
+    hdr_->version = ShmHeader::kVersion;
+    hdr_->payload_offset = kPayloadOffset;
+    hdr_->payload_size = sizeof(T);
+    new (payload()) T(std::forward<Args>(args)...);
+    hdr_->magic.store(ShmHeader::kMagic, std::memory_order_release);
+    return true;
+  }
+
+  // Attaches to a segment made by create(). Fails with EAGAIN while the
+  // creator is still initialising it and EPROTO on a layout mismatch.
+  bool open(const char* name) {
+    close();
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < segment_size()) {
+      ::close(fd);
+      errno = EAGAIN;
+      return false;
+    }
+    bool ok = map(fd);
+    ::close(fd);
+    if (!ok) {
+      return false;
+    }
+    if (hdr_->magic.load(std::memory_order_acquire) != ShmHeader::kMagic) {
+      close();
+      errno = EAGAIN;
+      return false;
+    }
+    if (hdr_->version != ShmHeader::kVersion || hdr_->payload_offset != kPayloadOffset ||
+        hdr_->payload_size != sizeof(T)) {
+      close();
+      errno = EPROTO;
+      return false;
+    }
+    return true;
+  }
+
+  // Unmaps the segment; the segment itself stays until unlink(). Guards
+  // taken through this object must be released first.
+  void close() {
+    if (hdr_ != nullptr) {
+      borrow_verify(live_ == 0, "ShmCell closed while its guards are alive");
+      munmap(hdr_, segment_size());
+      hdr_ = nullptr;
+      slot_ = nullptr;
+    }
+  }
+
+  static bool unlink(const char* name) {
+    return shm_unlink(name) == 0;
+  }
+
+  inline ShmRef<T> borrow_const() {
+    borrow_verify(!poisoned(), "ShmCell borrow_const on a poisoned cell");
+    ShmReaderSlot* slot = reader_slot();
+    bool ok = try_acquire_const(slot);
+    borrow_verify(ok, "verify failed in ShmCell borrow_const");
+    return ShmRef<T>(make_ref(slot), hdr_, &live_);
+  }
+
+  inline ShmRefMut<T> borrow_mut() {
+    borrow_verify(!poisoned(), "ShmCell borrow_mut on a poisoned cell");
+    bool ok = try_acquire_mut();
+    borrow_verify(ok, "verify failed in ShmCell borrow_mut");
+    return ShmRefMut<T>(make_mut(), hdr_, &live_);
+  }
+
+  // Blocks until no process holds a mutable borrow. Returns an empty guard
+  // if the cell is (or becomes) poisoned.
+  inline ShmRef<T> wait_const() {
+    ShmReaderSlot* slot = reader_slot();
+    for (;;) {
+      if (poisoned()) {
+        return ShmRef<T>();
+      }
+      if (try_acquire_const(slot)) {
+        return ShmRef<T>(make_ref(slot), hdr_, &live_);
+      }
+      int32_t c = hdr_->cnt_.load();
+      check_writer();
+      wait(c);
+    }
+  }
+
+  // Blocks until no process holds any borrow. Returns an empty guard if the
+  // cell is (or becomes) poisoned.
+  inline ShmRefMut<T> wait_mut() {
+    for (;;) {
+      if (poisoned()) {
+        return ShmRefMut<T>();
+      }
+      if (try_acquire_mut()) {
+        return ShmRefMut<T>(make_mut(), hdr_, &live_);
+      }
+      int32_t c = hdr_->cnt_.load();
+      reap_readers();
+      wait(c);
+    }
+  }
+
+  // Takes over the mutable borrow of a writer that died holding it. The
+  // poison is cleared and the caller repairs the payload through the
+  // returned guard. Returns an empty guard if the cell is not poisoned
+  // or another process recovered it first.
+  inline ShmRefMut<T> recover() {
+    uint64_t dead = hdr_->owner_.load();
+    if (!poisoned() || !hdr_->owner_.compare_exchange_strong(dead, id_)) {
+      return ShmRefMut<T>();
+    }
+    borrow_verify(hdr_->cnt_ == -1, "poisoned ShmCell without a mutable borrow");
+    hdr_->generation_++;
+    hdr_->poisoned_.store(0);
+    return ShmRefMut<T>(make_mut(), hdr_, &live_);
+  }
+
+  bool poisoned() const {
+    return hdr_->poisoned_.load() != 0;
+  }
+  uint32_t generation() const {
+    return hdr_->generation_.load();
+  }
+  int32_t owner_pid() const {
+    return static_cast<int32_t>(hdr_->owner_.load());
+  }
+  // Reads held by all processes.
+  int32_t readers() const {
+    int32_t n = 0;
+    for (auto& s : hdr_->readers_) {
+      n += s.count.load();
+    }
+    return n;
+  }
+  bool is_open() const {
+    return hdr_ != nullptr;
+  }
+  ShmHeader* header() {
+    return hdr_;
+  }
+
+ private:
+  // How often blocked processes look for dead holders.
+  static constexpr long kLivenessCheckNs = 10 * 1000 * 1000;
+  // Owner of a slot whose dead process is being reaped.
+  static constexpr uint64_t kReaping = ~0ULL;
+
+  static size_t segment_size() {
+    return kPayloadOffset + sizeof(T);
+  }
+
+  bool map(int fd) {
+    void* p = mmap(nullptr, segment_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    hdr_ = static_cast<ShmHeader*>(p);
+    id_ = detail::shm_process_id(static_cast<int32_t>(getpid()));
+    return true;
+  }
+
+  T* payload() {
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(hdr_) + hdr_->payload_offset);
+  }
+
+  // Readers count themselves before they look at the writer word, writers
+  // take it before they look at the slots (all sequentially consistent), so
+  // a reader and a writer never both get in.
+  bool try_acquire_const(ShmReaderSlot* slot) {
+    slot->count++;
+    if (hdr_->cnt_.load() == 0) {
+      return true;
+    }
+    slot->count--;
+    if (hdr_->waiters_.load() > 0) {
+      detail::futex_wake_all(&hdr_->cnt_);  // a writer may wait for the slot
+    }
+    return false;
+  }
+
+  bool try_acquire_mut() {
+    uint64_t owner = 0;
+    if (!hdr_->owner_.compare_exchange_strong(owner, id_)) {
+      return false;
+    }
+    int32_t expected = 0;
+    if (!hdr_->cnt_.compare_exchange_strong(expected, -1)) {
+      hdr_->owner_.store(0);
+      return false;
+    }
+    for (auto& s : hdr_->readers_) {
+      if (s.count.load() != 0) {
+        hdr_->cnt_.store(0);
+        hdr_->owner_.store(0);
+        if (hdr_->waiters_.load() > 0) {
+          detail::futex_wake_all(&hdr_->cnt_);
+        }
+        return false;
+      }
+    }
+    hdr_->generation_++;
+    return true;
+  }
+
+  // A dead owner either held the writer word (poison) or died outside of it
+  // (just clear the owner word).
+  void check_writer() {
+    uint64_t owner = hdr_->owner_.load();
+    if (owner == 0 || owner == id_ || !detail::shm_process_dead(owner)) {
+      return;
+    }
+    if (hdr_->cnt_.load() == -1) {
+      hdr_->poisoned_.store(1);
+    } else {
+      hdr_->owner_.compare_exchange_strong(owner, 0);
+    }
+    detail::futex_wake_all(&hdr_->cnt_);
+  }
+
+  // A slot only counts its own process's reads, so clearing a dead
+  // process's slot releases exactly what it held.
+  void reap_readers() {
+    for (auto& s : hdr_->readers_) {
+      uint64_t owner = s.owner.load();
+      if (owner == 0 || owner == kReaping || owner == id_ || !detail::shm_process_dead(owner)) {
+        continue;
+      }
+      if (s.owner.compare_exchange_strong(owner, kReaping)) {
+        s.count.store(0);
+        s.owner.store(0);
+      }
+    }
+    check_writer();
+  }
+
+  ShmReaderSlot* reader_slot() {
+    if (slot_ != nullptr) {
+      return slot_;
+    }
+    for (auto& s : hdr_->readers_) {
+      if (s.owner.load() == id_) {
+        slot_ = &s;
+        return slot_;
+      }
+    }
+    for (auto& s : hdr_->readers_) {
+      uint64_t expected = 0;
+      if (s.owner.compare_exchange_strong(expected, id_)) {
+        slot_ = &s;
+        return slot_;
+      }
+    }
+    borrow_verify(false, "ShmCell ran out of reader slots");
+    return nullptr;
+  }
+
+  void wait(int32_t seen) {
+    timespec ts{0, kLivenessCheckNs};
+    hdr_->waiters_++;
+    detail::futex_wait(&hdr_->cnt_, seen, &ts);
+    hdr_->waiters_--;
+  }
+
+  Ref<T> make_ref(ShmReaderSlot* slot) {
+    Ref<T> ref;
+    ref.raw_ = payload();
+    ref.p_cnt_ = &slot->count;
+    return ref;
+  }
+
+  RefMut<T> make_mut() {
+    RefMut<T> mut;
+    mut.p_cnt_ = &hdr_->cnt_;
+    mut.raw_ = payload();
+    return mut;
+  }
+
+  ShmHeader* hdr_{nullptr};
+  ShmReaderSlot* slot_{nullptr};
+  uint64_t id_{0};
+  std::atomic<int32_t> live_{0};
+};
+
+} // namespace borrow
@@ -0,0 +1,254 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+namespace borrow {
+
+// Binary borrow trace (BORROW_TRACE).
+//
+// Between trace_start(dir) and trace_stop(), every RefCell borrow and every
+// Ref/RefMut release appends one fixed-size TraceRecord to a per-thread
+// file, dir/borrow-trace.<pid>.<tid>.<session>. The file is mapped in
+// BORROW_TRACE_CHUNK windows, so appending is a store into the mapping;
+// only moving to the next window makes system calls. Cells are identified
+// by the address of their borrow counter (as in violation records), sites
+// by the PC of the borrow or release. Guards of the other cells are traced
+// on release only.
+//
+// A file is a TraceFileHeader followed by records; the tail of the last
+// window is zero-filled and ends at the first record with op 0. The header's
+// count is filled in when the thread's file is closed (thread exit,
+// trace_close_thread(), or the thread's first event of a later session) and
+// is 0 if the process died first. tools/borrow_trace_analyze.cc reads these files.
+//
+// BORROW_TRACE changes what borrow.h compiles to, so it has to be set for
+// every translation unit, i.e. on the command line.
+
+#ifndef BORROW_TRACE_CHUNK
+#define BORROW_TRACE_CHUNK (1 << 20)
+#endif
+
+enum class TraceOp : uint8_t {
+  None,
+  Shared,         // borrow_const / Ref copy
+  SharedRelease,
+  Mut,            // borrow_mut
+  MutRelease,
+};
+
+struct TraceRecord {
+  uint64_t ts_ns;  // CLOCK_MONOTONIC
+  uint64_t cell;   // address of the cell's borrow counter
+  uint64_t site;   // PC
+  uint32_t tid;
+  TraceOp op;
+  uint8_t pad[3];
+};
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord layout is part of the file format");
+
+struct TraceFileHeader {
+  char magic[8];  // "BRWTRC1"
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t count;     // records, 0 if not closed cleanly
+  uint64_t start_ns;  // CLOCK_MONOTONIC at file creation
+  uint8_t pad[24];
+};
+static_assert(sizeof(TraceFileHeader) == 64, "TraceFileHeader layout is part of the file format");
+
+static const char kTraceMagic[8] = "BRWTRC1";
+static const uint32_t kTraceVersion = 1;
+
+struct TraceControl {
+  std::atomic<bool> on{false};
+  std::atomic<uint32_t> session{0};
+  std::atomic<uint64_t> errors{0};  // files that failed to open, map or close
+  char dir[256]{};
+};
+
+template <class Dummy>
+struct TraceControlHolder {
+  static TraceControl ctl;
+};
+template <class Dummy>
+TraceControl TraceControlHolder<Dummy>::ctl;
+
+inline TraceControl& trace_control() {
+  return TraceControlHolder<void>::ctl;
+}
+
+inline bool trace_on() {
+  return trace_control().on.load(std::memory_order_relaxed);
+}
+
+// Trace files that could not be created, extended or finished since the
+// start of the process. A file that failed to close keeps a count of 0 (its
+// records end at the zero-filled tail) or a zero-filled tail.
+inline uint64_t trace_errors() {
+  return trace_control().errors.load(std::memory_order_relaxed);
+}
+
+namespace detail {
+
+inline uint64_t trace_now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+class TraceWriter {
+ public:
+  ~TraceWriter() {
+    close();
+  }
+
+  inline void append(TraceOp op, const void* cell, const void* site) {
+    uint32_t session = trace_control().session.load(std::memory_order_acquire);
+    if (session != session_) {
+      close();
+      open(session);
+    }
+    if (fd_ < 0) {
+      return;  // closed, or failed to open, for this session
+    }
+    if (pos_ + sizeof(TraceRecord) > BORROW_TRACE_CHUNK && !next_window()) {
+      return;
+    }
+    TraceRecord* rec = reinterpret_cast<TraceRecord*>(map_ + pos_);
+    rec->ts_ns = trace_now_ns();
+    rec->cell = reinterpret_cast<uintptr_t>(cell);
+    rec->site = reinterpret_cast<uintptr_t>(site);
+    rec->tid = tid_;
+    rec->op = op;
+    pos_ += sizeof(TraceRecord);
+    count_++;
+  }
+
+  void close() {
+    if (fd_ < 0) {
+      return;
+    }
+    munmap(map_, BORROW_TRACE_CHUNK);
+    // fill in the count and cut off the unused tail of the last window
+    bool ok = pwrite(fd_, &count_, sizeof(count_), offsetof(TraceFileHeader, count)) ==
+              static_cast<ssize_t>(sizeof(count_));
+    ok = ftruncate(fd_, static_cast<off_t>(window_off_ + pos_)) == 0 && ok;
+    ok = ::close(fd_) == 0 && ok;
+    if (!ok) {
+      trace_control().errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    fd_ = -1;
+    map_ = nullptr;
+  }
+
+ private:
+  void open(uint32_t session) {
+    session_ = session;
+    tid_ = static_cast<uint32_t>(syscall(SYS_gettid));
+    char path[320];
+    snprintf(path, sizeof(path), "%s/borrow-trace.%d.%u.%u", trace_control().dir, static_cast<int>(getpid()), tid_,
+             session);
+    fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      trace_control().errors.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    window_off_ = 0;
+    if (!map_window()) {
+      return;
+    }
+    TraceFileHeader* hdr = reinterpret_cast<TraceFileHeader*>(map_);
+    memcpy(hdr->magic, kTraceMagic, sizeof(hdr->magic));
+    hdr->version = kTraceVersion;
+    hdr->record_size = sizeof(TraceRecord);
+    hdr->pid = static_cast<uint32_t>(getpid());
+    hdr->tid = tid_;
+    hdr->start_ns = trace_now_ns();
+    pos_ = sizeof(TraceFileHeader);
+    count_ = 0;
+  }
+
+  bool next_window() {
+    munmap(map_, BORROW_TRACE_CHUNK);
+    map_ = nullptr;
+    window_off_ += BORROW_TRACE_CHUNK;  // records never straddle windows
+    return map_window();
+  }
+
+  bool map_window() {
+    static_assert(BORROW_TRACE_CHUNK % 4096 == 0 && BORROW_TRACE_CHUNK % sizeof(TraceRecord) == 0,
+                  "BORROW_TRACE_CHUNK must be a multiple of the page size");
+    void* p = MAP_FAILED;
+    if (ftruncate(fd_, static_cast<off_t>(window_off_ + BORROW_TRACE_CHUNK)) == 0) {
+      p = mmap(nullptr, BORROW_TRACE_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(window_off_));
+    }
+    if (p == MAP_FAILED) {
+      ::close(fd_);
+      fd_ = -1;
+      trace_control().errors.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    map_ = static_cast<char*>(p);
+    pos_ = 0;
+    return true;
+  }
+
+  uint32_t session_{0};
+  int fd_{-1};
+  char* map_{nullptr};
+  size_t window_off_{0};
+  size_t pos_{0};
+  uint64_t count_{0};
+  uint32_t tid_{0};
+};
+
+inline TraceWriter& trace_writer() {
+  static thread_local TraceWriter writer;
+  return writer;
+}
+
+} // namespace detail
+
+// Out of line so that its return address is the traced operation's site.
+__attribute__((noinline)) inline void trace_event(TraceOp op, const void* cell) {
+  detail::trace_writer().append(op, cell, __builtin_return_address(0));
+}
+
+#define BORROW_TRACE_EVENT(op, p_cnt) \
+    do { \
+        if (::borrow::trace_on()) { \
+            ::borrow::trace_event(::borrow::TraceOp::op, p_cnt); \
+        } \
+    } while(0)
+
+// Starts a new session writing into dir (which must exist). Threads open
+// their file on their first traced event; stop the previous session before
+// starting the next one.
+inline void trace_start(const char* dir) {
+  TraceControl& ctl = trace_control();
+  snprintf(ctl.dir, sizeof(ctl.dir), "%s", dir);
+  ctl.session.fetch_add(1, std::memory_order_release);
+  ctl.on.store(true, std::memory_order_relaxed);
+}
+
+// Stops tracing. Files are closed by their threads; see trace_close_thread().
+inline void trace_stop() {
+  trace_control().on.store(false, std::memory_order_relaxed);
+}
+
+// Closes the calling thread's file now instead of at thread exit. Its later
+// events in the same session are dropped.
+inline void trace_close_thread() {
+  detail::trace_writer().close();
+}
+
+} // namespace borrow
@@ -0,0 +1,195 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <liburing.h>
+#include "borrow.h"
+namespace borrow {
+
+class UringBufferPool;
+
+// One buffer of an UringBufferPool. The bytes are the borrower's, the
+// description is the pool's: it is read-only through the guard. `index()`
+// is the fixed-buffer index when the pool registered its buffers with the
+// ring, -1 otherwise.
+class IoBuffer {
+ public:
+  IoBuffer(const IoBuffer&) = delete;
+  IoBuffer& operator=(const IoBuffer&) = delete;
+
+  char* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  int index() const {
+    return index_;
+  }
+
+ private:
+  friend class UringBufferPool;
+  IoBuffer() = default;
+
+  char* data_{nullptr};
+  size_t size_{0};
+  int index_{-1};
+  size_t slot_{0};
+};
+
+// Buffer pool for io_uring where every buffer is borrow checked.
+//
+// acquire() hands out a RefMut<IoBuffer>. Submitting an operation moves that
+// RefMut into the pool's in-flight record for the buffer, so userspace can
+// not touch the buffer (or borrow it again) while the kernel owns it.
+// reap() gives the RefMut back to the completion handler together with the
+// cqe result. Dropping the RefMut returns the buffer to the pool.
+//
+// The pool does not own the ring and is meant to be used from the thread
+// that drives the ring. Every sqe submitted through the ring must come from
+// this pool (reap() interprets user_data as a pool slot).
+class UringBufferPool {
+  struct Slot {
+    IoBuffer buf;
+    std::atomic<int32_t> cnt_{0};
+    RefMut<IoBuffer> inflight;
+    uint64_t tag{0};
+  };
+
+ public:
+  UringBufferPool(const UringBufferPool&) = delete;
+  UringBufferPool(io_uring* ring, size_t count, size_t buf_size, bool register_fixed = true)
+      : ring_(ring), count_(count), buf_size_(buf_size), slots_(new Slot[count]) {
+    void* mem = nullptr;
+    int ret = posix_memalign(&mem, 4096, count * buf_size);
+    borrow_verify(ret == 0, "UringBufferPool failed to allocate buffers");
+    mem_ = static_cast<char*>(mem);
+    std::unique_ptr<iovec[]> iovs(new iovec[count]);
+    for (size_t i = 0; i < count; i++) {
+      slots_[i].buf.data_ = mem_ + i * buf_size;
+      slots_[i].buf.size_ = buf_size;
+      slots_[i].buf.slot_ = i;
+      iovs[i].iov_base = slots_[i].buf.data_;
+      iovs[i].iov_len = buf_size;
+    }
+    if (register_fixed && io_uring_register_buffers(ring_, iovs.get(), count) == 0) {
+      registered_ = true;
+      for (size_t i = 0; i < count; i++) {
+        slots_[i].buf.index_ = static_cast<int>(i);
+      }
+    }
+  }
+
+  ~UringBufferPool() {
+    for (size_t i = 0; i < count_; i++) {
+      borrow_verify(slots_[i].cnt_ == 0, "UringBufferPool destroyed with a buffer borrowed or in flight");
+    }
+    if (registered_) {
+      io_uring_unregister_buffers(ring_);
+    }
+    free(mem_);
+  }
+
+  // Returns an empty RefMut when every buffer is borrowed or in flight.
+  inline RefMut<IoBuffer> acquire() {
+    for (size_t n = 0; n < count_; n++) {
+      size_t i = hint_++ % count_;
+      int32_t expected = 0;
+      if (slots_[i].cnt_.compare_exchange_strong(expected, -1)) {
+        RefMut<IoBuffer> mut;
+        mut.p_cnt_ = &slots_[i].cnt_;
+        mut.raw_ = &slots_[i].buf;
+        return mut;
+      }
+    }
+    return RefMut<IoBuffer>();
+  }
+
+  // Queue a read of `len` bytes at `offset` into the buffer. On success the
+  // buffer is moved into the in-flight record and `buf` is left empty; on
+  // failure (submission queue full) `buf` is untouched.
+  inline bool prep_read(int fd, RefMut<IoBuffer>& buf, unsigned len, off_t offset, uint64_t tag = 0) {
+    return prep(fd, buf, len, offset, tag, true);
+  }
+
+  inline bool prep_write(int fd, RefMut<IoBuffer>& buf, unsigned len, off_t offset, uint64_t tag = 0) {
+    return prep(fd, buf, len, offset, tag, false);
+  }
+
+  inline int submit() {
+    return io_uring_submit(ring_);
+  }
+
+  // Hand completed buffers back: fn(RefMut<IoBuffer>&& buf, int res, uint64_t tag).
+  // The buffer returns to the pool after fn unless fn moved it elsewhere.
+  // With `wait` set, blocks until at least one completion is available.
+  // Returns the number of completions handled.
+  template <class F>
+  unsigned reap(F&& fn, bool wait = false) {
+    unsigned n = 0;
+    io_uring_cqe* cqe = nullptr;
+    if (wait && io_uring_wait_cqe(ring_, &cqe) < 0) {
+      return 0;
+    }
+    while (io_uring_peek_cqe(ring_, &cqe) == 0 && cqe != nullptr) {
+      auto* s = static_cast<Slot*>(io_uring_cqe_get_data(cqe));
+      int res = cqe->res;
+      io_uring_cqe_seen(ring_, cqe);
+      borrow_verify(s != nullptr && s->inflight, "completion for a buffer that is not in flight");
+      RefMut<IoBuffer> buf = std::move(s->inflight);
+      fn(std::move(buf), res, s->tag);
+      n++;
+    }
+    return n;
+  }
+
+  bool registered() const {
+    return registered_;
+  }
+  size_t buffer_size() const {
+    return buf_size_;
+  }
+
+ private:
+  inline bool prep(int fd, RefMut<IoBuffer>& buf, unsigned len, off_t offset, uint64_t tag, bool read) {
+    borrow_verify(buf, "submitting an empty RefMut<IoBuffer>");
+    Slot& s = slot_of(buf);
+    borrow_verify(!s.inflight, "buffer is already in flight");
+    borrow_verify(len <= buf_size_, "io length exceeds buffer size");
+    io_uring_sqe* sqe = io_uring_get_sqe(ring_);
+    if (sqe == nullptr) {
+      return false;
+    }
+    if (registered_ && read) {
+      io_uring_prep_read_fixed(sqe, fd, s.buf.data_, len, offset, s.buf.index_);
+    } else if (registered_) {
+      io_uring_prep_write_fixed(sqe, fd, s.buf.data_, len, offset, s.buf.index_);
+    } else if (read) {
+      io_uring_prep_read(sqe, fd, s.buf.data_, len, offset);
+    } else {
+      io_uring_prep_write(sqe, fd, s.buf.data_, len, offset);
+    }
+    io_uring_sqe_set_data(sqe, &s);
+    s.tag = tag;
+    s.inflight = std::move(buf);
+    return true;
+  }
+
+  inline Slot& slot_of(RefMut<IoBuffer>& buf) {
+    size_t i = buf.raw_->slot_;
+    borrow_verify(i < count_ && &slots_[i].buf == buf.raw_, "RefMut<IoBuffer> does not belong to this pool");
+    return slots_[i];
+  }
+
+  io_uring* ring_;
+  size_t count_;
+  size_t buf_size_;
+  std::unique_ptr<Slot[]> slots_;
+  char* mem_{nullptr};
+  size_t hint_{0};
+  bool registered_{false};
+};
+
+} // namespace borrow
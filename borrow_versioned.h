@@ -0,0 +1,244 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "borrow.h"
+namespace borrow {
+
+// Versioned cells: every release of a mutable borrow bumps the cell's
+// version, so consumers can poll version() instead of rescanning values.
+//
+// A cell may be attached to a DirtySet; a release then also pushes the cell
+// onto that set (once until the next drain). Subscribers run after the
+// borrow is released, never while it is held: right away for cells without
+// a DirtySet, or batched once per dirty cell in DirtySet::drain(). A cell
+// must not be destroyed while it is on its DirtySet, i.e. between a release
+// and the next drain.
+
+class DirtySet;
+
+// Type independent part of a VersionedCell, which is what DirtySet and
+// subscribers see.
+class VersionedBase {
+ public:
+  using Subscriber = std::function<void(VersionedBase&)>;
+
+  VersionedBase() = default;
+  VersionedBase(const VersionedBase&) = delete;
+
+  uint64_t version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  void attach(DirtySet* set) {
+    dirty_set_ = set;
+  }
+
+  DirtySet* dirty_set() const {
+    return dirty_set_;
+  }
+
+  // Returns an id for unsubscribe(). Ids are never reused, so unsubscribing
+  // twice can not remove a later subscriber.
+  size_t subscribe(Subscriber fn) {
+    std::lock_guard<std::mutex> lock(subs_mu_);
+    subs_.push_back(std::make_pair(next_id_, std::move(fn)));
+    return next_id_++;
+  }
+
+  // A notification already running may still call the subscriber once.
+  void unsubscribe(size_t id) {
+    std::lock_guard<std::mutex> lock(subs_mu_);
+    for (size_t i = 0; i < subs_.size(); i++) {
+      if (subs_[i].first == id) {
+        subs_.erase(subs_.begin() + i);
+        return;
+      }
+    }
+  }
+
+ protected:
+  // The DirtySet would keep pointing at a dirty cell.
+  ~VersionedBase() {
+    borrow_verify(!dirty_, "versioned cell destroyed before its DirtySet was drained");
+  }
+
+  inline void on_mut_released();
+  // Runs the subscribers outside subs_mu_, so they may subscribe,
+  // unsubscribe or borrow this cell again.
+  void notify() {
+    std::vector<std::pair<size_t, Subscriber>> subs;
+    {
+      std::lock_guard<std::mutex> lock(subs_mu_);
+      subs = subs_;
+    }
+    for (auto& s : subs) {
+      s.second(*this);
+    }
+  }
+
+  std::atomic<uint64_t> version_{0};
+  std::atomic<int32_t> cnt_{0};
+
+ private:
+  friend class DirtySet;
+  template <class T>
+  friend class VersionedMut;
+
+  DirtySet* dirty_set_{nullptr};
+  std::atomic<bool> dirty_{false};
+  VersionedBase* next_dirty_{nullptr};
+  std::mutex subs_mu_;
+  std::vector<std::pair<size_t, Subscriber>> subs_;
+  size_t next_id_{0};
+};
+
+// Cells mutated since the last drain. Pushing is a lock-free CAS on the list
+// head and happens at most once per cell between drains.
+class DirtySet {
+ public:
+  DirtySet() = default;
+  DirtySet(const DirtySet&) = delete;
+
+  // Calls fn(cell) for every cell marked since the last drain, then runs the
+  // cell's subscribers. Returns the number of cells drained.
+  template <class F>
+  size_t drain(F&& fn) {
+    VersionedBase* p = head_.exchange(nullptr, std::memory_order_acquire);
+    size_t n = 0;
+    while (p != nullptr) {
+      VersionedBase* next = p->next_dirty_;
+      p->dirty_.store(false, std::memory_order_release);
+      fn(*p);
+      p->notify();
+      p = next;
+      n++;
+    }
+    return n;
+  }
+
+  size_t drain() {
+    return drain([](VersionedBase&) {});
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_relaxed) == nullptr;
+  }
+
+ private:
+  friend class VersionedBase;
+
+  void push(VersionedBase* cell) {
+    if (cell->dirty_.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+    VersionedBase* head = head_.load(std::memory_order_relaxed);
+    do {
+      cell->next_dirty_ = head;
+    } while (!head_.compare_exchange_weak(head, cell, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  std::atomic<VersionedBase*> head_{nullptr};
+};
+
+inline void VersionedBase::on_mut_released() {
+  if (dirty_set_ != nullptr) {
+    dirty_set_->push(this);
+  } else {
+    notify();
+  }
+}
+
+// Mutable guard of a VersionedCell; releasing it publishes a new version.
+template <class T>
+class VersionedMut {
+ public:
+  VersionedMut() = default;
+  VersionedMut(const VersionedMut&) = delete;
+  VersionedMut(VersionedMut&& p) : mut_(std::move(p.mut_)), cell_(p.cell_) {
+    p.cell_ = nullptr;
+  }
+  ~VersionedMut() {
+    reset();
+  }
+  T* operator->() {
+    return mut_.operator->();
+  }
+  T& operator*() {
+    return *mut_;
+  }
+  explicit operator bool() const {
+    return static_cast<bool>(mut_);
+  }
+  void reset() {
+    if (mut_) {
+      cell_->version_.fetch_add(1, std::memory_order_release);
+      mut_.reset();
+      cell_->on_mut_released();
+    }
+    cell_ = nullptr;
+  }
+
+ private:
+  template <class U>
+  friend class VersionedCell;
+  RefMut<T> mut_;
+  VersionedBase* cell_{nullptr};
+};
+
+template <class T>
+class VersionedCell : public VersionedBase {
+ public:
+  VersionedCell() = default;
+  explicit VersionedCell(T* p) : raw_(p) {
+  }
+  ~VersionedCell() {
+    borrow_verify(cnt_ == 0, "VersionedCell destroyed while borrowed");
+    delete raw_;
+  }
+
+  inline Ref<T> borrow_const() {
+    auto i = cnt_++;
+    borrow_verify(i >= 0, "verify failed in VersionedCell borrow_const");
+    Ref<T> ref;
+    ref.raw_ = raw_;
+    ref.p_cnt_ = &cnt_;
+    return ref;
+  }
+
+  inline VersionedMut<T> borrow_mut() {
+    int32_t expected = 0;
+    bool ok = cnt_.compare_exchange_strong(expected, -1);
+    borrow_verify(ok, "verify failed in VersionedCell borrow_mut");
+    VersionedMut<T> mut;
+    mut.mut_.p_cnt_ = &cnt_;
+    mut.mut_.raw_ = raw_;
+    mut.cell_ = this;
+    return mut;
+  }
+
+  // Replacing the value counts as a mutation.
+  void reset(T* p) {
+    auto mut = borrow_mut();
+    delete raw_;
+    raw_ = p;
+    mut.mut_.raw_ = p;
+  }
+
+ private:
+  T* raw_{nullptr};
+};
+
+template <typename T>
+inline Ref<T> borrow_const(VersionedCell<T>& cell) {
+  return cell.borrow_const();
+}
+
+template <typename T>
+inline VersionedMut<T> borrow_mut(VersionedCell<T>& cell) {
+  return cell.borrow_mut();
+}
+
+} // namespace borrow
@@ -0,0 +1,201 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+#include "borrow.h"
+namespace borrow {
+
+// Zero-copy views into a borrowed buffer.
+//
+// A ViewBorrow takes over one Ref on the buffer cell; every view handed out
+// by it shares that single borrow, so parsing costs one counter increment no
+// matter how many views it produces. While the ViewBorrow is alive the cell
+// stays shared-borrowed, hence borrow_mut (a refill) is rejected.
+//
+// With BORROW_DEBUG the ViewBorrow also counts live views and aborts if it
+// is destroyed (releasing the buffer) while a view still exists. Without it
+// the views are a bare pointer and length.
+
+namespace detail {
+
+// Debug-only link from a view back to its ViewBorrow.
+class ViewAnchor {
+ public:
+#if BORROW_DEBUG
+  ViewAnchor() = default;
+  explicit ViewAnchor(std::atomic<int32_t>* p) : p_views_(p) {
+    acquire();
+  }
+  ViewAnchor(const ViewAnchor& o) : p_views_(o.p_views_) {
+    acquire();
+  }
+  ViewAnchor& operator=(const ViewAnchor& o) {
+    if (this != &o) {
+      release();
+      p_views_ = o.p_views_;
+      acquire();
+    }
+    return *this;
+  }
+  ~ViewAnchor() {
+    release();
+  }
+  std::atomic<int32_t>* p_views_{nullptr};
+
+ private:
+  void acquire() {
+    if (p_views_ != nullptr) {
+      p_views_->fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  void release() {
+    if (p_views_ != nullptr) {
+      auto i = p_views_->fetch_sub(1, std::memory_order_relaxed);
+      borrow_verify(i > 0, "error in borrowed view release");
+    }
+  }
+#else
+  ViewAnchor() = default;
+  explicit ViewAnchor(std::atomic<int32_t>*) {
+  }
+#endif
+};
+
+} // namespace detail
+
+// The anchor is a base class so that it takes no space without BORROW_DEBUG.
+class BorrowedStringView : private detail::ViewAnchor {
+ public:
+  BorrowedStringView() = default;
+  BorrowedStringView(std::string_view sv, const detail::ViewAnchor& anchor) : detail::ViewAnchor(anchor), sv_(sv) {
+  }
+  const char* data() const {
+    return sv_.data();
+  }
+  size_t size() const {
+    return sv_.size();
+  }
+  bool empty() const {
+    return sv_.empty();
+  }
+  const char* begin() const {
+    return sv_.data();
+  }
+  const char* end() const {
+    return sv_.data() + sv_.size();
+  }
+  char operator[](size_t i) const {
+    return sv_[i];
+  }
+  // Only valid while this view (and so the borrow) is alive.
+  std::string_view sv() const {
+    return sv_;
+  }
+  BorrowedStringView substr(size_t pos, size_t len = std::string_view::npos) const {
+    return BorrowedStringView(sv_.substr(pos, len), *this);
+  }
+  friend bool operator==(const BorrowedStringView& a, std::string_view b) {
+    return a.sv_ == b;
+  }
+  friend bool operator!=(const BorrowedStringView& a, std::string_view b) {
+    return a.sv_ != b;
+  }
+
+ private:
+  std::string_view sv_;
+};
+
+template <class T>
+class BorrowedSpan : private detail::ViewAnchor {
+ public:
+  BorrowedSpan() = default;
+  BorrowedSpan(const T* p, size_t n, const detail::ViewAnchor& anchor) : detail::ViewAnchor(anchor), p_(p), n_(n) {
+  }
+  const T* data() const {
+    return p_;
+  }
+  size_t size() const {
+    return n_;
+  }
+  bool empty() const {
+    return n_ == 0;
+  }
+  const T* begin() const {
+    return p_;
+  }
+  const T* end() const {
+    return p_ + n_;
+  }
+  const T& operator[](size_t i) const {
+    return p_[i];
+  }
+  BorrowedSpan subspan(size_t pos, size_t len) const {
+    borrow_verify(pos <= n_ && len <= n_ - pos, "BorrowedSpan::subspan out of range");
+    return BorrowedSpan(p_ + pos, len, *this);
+  }
+
+ private:
+  const T* p_{nullptr};
+  size_t n_{0};
+};
+
+// B is a contiguous buffer with data()/size(), e.g. std::string or
+// std::vector<char>.
+template <class B>
+class ViewBorrow {
+ public:
+  using value_type = typename std::remove_cv<
+      typename std::remove_reference<decltype(*std::declval<const B&>().data())>::type>::type;
+
+  ViewBorrow(const ViewBorrow&) = delete;
+  explicit ViewBorrow(Ref<B>&& ref) : ref_(std::move(ref)) {
+    borrow_verify(ref_, "ViewBorrow needs a live Ref");
+  }
+  explicit ViewBorrow(RefCell<B>& cell) : ref_(cell.borrow_const()) {
+  }
+  ~ViewBorrow() {
+#if BORROW_DEBUG
+    borrow_verify(views_ == 0, "buffer borrow released while views are alive");
+#endif
+  }
+
+  const value_type* data() {
+    return ref_->data();
+  }
+  size_t size() {
+    return ref_->size();
+  }
+
+  BorrowedStringView view() {
+    return view(0, size());
+  }
+  BorrowedStringView view(size_t offset, size_t len) {
+    static_assert(sizeof(value_type) == 1, "string views need a byte buffer");
+    borrow_verify(offset <= size() && len <= size() - offset, "ViewBorrow::view out of range");
+    return BorrowedStringView(std::string_view(reinterpret_cast<const char*>(data()) + offset, len), anchor());
+  }
+
+  BorrowedSpan<value_type> span() {
+    return span(0, size());
+  }
+  BorrowedSpan<value_type> span(size_t offset, size_t count) {
+    borrow_verify(offset <= size() && count <= size() - offset, "ViewBorrow::span out of range");
+    return BorrowedSpan<value_type>(data() + offset, count, anchor());
+  }
+
+ private:
+  detail::ViewAnchor anchor() {
+#if BORROW_DEBUG
+    return detail::ViewAnchor(&views_);
+#else
+    return detail::ViewAnchor(nullptr);
+#endif
+  }
+
+  Ref<B> ref_;
+#if BORROW_DEBUG
+  std::atomic<int32_t> views_{0};
+#endif
+};
+
+} // namespace borrow
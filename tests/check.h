@@ -0,0 +1,49 @@
+// Minimal checking for the test programs in this directory: CHECK reports
+// the failed condition with its location and keeps going, CHECK_ABORTS
+// expects a statement to fail a borrow check, and main() returns
+// check_result(), which also prints a summary line.
+#pragma once
+#include <csignal>
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+
+template <class Dummy>
+struct CheckCounts {
+  static int run;
+  static int failed;
+};
+template <class Dummy>
+int CheckCounts<Dummy>::run = 0;
+template <class Dummy>
+int CheckCounts<Dummy>::failed = 0;
+
+#define CHECK(x) \
+    do { \
+        CheckCounts<void>::run++; \
+        if (!(x)) { \
+            CheckCounts<void>::failed++; \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); \
+        } \
+    } while(0)
+
+inline int check_result(const char* name) {
+  printf("%s: %d checks, %d failed\n", name, CheckCounts<void>::run, CheckCounts<void>::failed);
+  return CheckCounts<void>::failed == 0 ? 0 : 1;
+}
+
+// Runs `stmt` in a forked child and checks that it aborts (a failed
+// borrow_verify).
+#define CHECK_ABORTS(stmt) \
+    do { \
+        fflush(nullptr); \
+        pid_t pid_ = fork(); \
+        if (pid_ == 0) { \
+            freopen("/dev/null", "w", stderr); \
+            stmt; \
+            _exit(0); \
+        } \
+        int status_ = 0; \
+        waitpid(pid_, &status_, 0); \
+        CHECK(WIFSIGNALED(status_) && WTERMSIG(status_) == SIGABRT); \
+    } while(0)
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Builds and runs every test_*.cc here with the build line from its header
+# comment. Tests whose "// requires: <header>" is not installed are skipped.
+cd "$(dirname "$0")"
+status=0
+for f in test_*.cc; do
+  req=$(grep -m1 '^// requires: ' "$f" | sed 's|^// requires: ||')
+  if [ -n "$req" ] && ! echo "#include $req" | ${CXX:-g++} -E -x c++ - > /dev/null 2>&1; then
+    echo "$f: skipped, $req not found"
+    continue
+  fi
+  cmd=$(grep -m1 '^// g++ ' "$f" | sed 's|^// ||')
+  if ! bash -c "$cmd"; then
+    echo "$f: FAILED"
+    status=1
+  fi
+done
+exit $status
@@ -0,0 +1,144 @@
+// AdaptiveCell: switches to per-CPU readers on reader fan-out and back on
+// writes or when traffic cools, excludes readers from writers in every mode,
+// and lets nested reads past a writer waiting for them.
+//
+// g++ -std=c++11 -g -O1 -pthread -I.. test_adaptive.cc ../borrow_diag.cc -o test_adaptive && ./test_adaptive
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../borrow_adaptive.h"
+#include "check.h"
+using namespace borrow;
+
+static AdaptivePolicy eager_policy() {
+  AdaptivePolicy p;
+  p.sample_every = 1;
+  p.window = 8;
+  p.percore_fanout = 1.5;
+  p.cool_ns = 60ull * 1000000000;
+  return p;
+}
+
+static void switches() {
+  AdaptiveCell<int> cell(new int(0), eager_policy());
+  CHECK(cell.mode() == AdaptiveMode::Counter);
+  for (int i = 0; i < 16; i++) {
+    AdaptiveRef<int> a = cell.borrow_const();
+    AdaptiveRef<int> b = cell.borrow_const();  // sees fan-out 2
+  }
+  CHECK(cell.mode() == AdaptiveMode::PerCore);
+  {
+    AdaptiveRef<int> r = cell.borrow_const();
+    CHECK(*r == 0);
+  }
+  for (int i = 0; i < 16; i++) {
+    *cell.borrow_mut() += 1;  // writes make draining the slots expensive
+  }
+  CHECK(cell.mode() == AdaptiveMode::Counter);
+  CHECK(*cell.borrow_const() == 16);
+  AdaptiveStats s = cell.stats();
+  CHECK(s.switches == 2 && s.samples >= 48);
+}
+
+// The writer makes the value odd while it holds the cell; no reader may
+// ever see an odd value, whatever mode the cell is in.
+static void exclusion(AdaptiveMode start) {
+  AdaptivePolicy p = eager_policy();
+  p.start = start;
+  AdaptiveCell<long> cell(new long(0), p);
+  std::atomic<bool> done{false};
+  std::atomic<long> odd{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; t++) {
+    readers.emplace_back([&] {
+      while (!done.load()) {
+        AdaptiveRef<long> a = cell.borrow_const();
+        std::this_thread::yield();
+        AdaptiveRef<long> b = cell.borrow_const();
+        if (*a % 2 != 0 || *b != *a) {
+          odd++;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 2000; i++) {
+    AdaptiveRefMut<long> m = cell.borrow_mut();
+    *m += 1;
+    std::this_thread::yield();
+    *m += 1;
+  }
+  done = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  CHECK(odd == 0);
+  CHECK(*cell.borrow_const() == 4000);
+}
+
+static void cools_down() {
+  AdaptivePolicy p = eager_policy();
+  p.window = 1000;
+  p.cool_ns = 200000000;
+  AdaptiveCell<int> cell(new int(0), p);
+  for (int i = 0; i < 1000; i++) {
+    AdaptiveRef<int> a = cell.borrow_const();
+    AdaptiveRef<int> b = cell.borrow_const();
+  }
+  CHECK(cell.mode() == AdaptiveMode::PerCore);
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  cell.borrow_const();  // closes the stale window without filling it
+  CHECK(cell.mode() == AdaptiveMode::Counter);
+}
+
+static void no_sampling() {
+  AdaptivePolicy p = eager_policy();
+  p.sample_every = 0;
+  p.start = AdaptiveMode::Parking;
+  AdaptiveCell<int> cell(new int(0), p);
+  for (int i = 0; i < 100; i++) {
+    AdaptiveRef<int> a = cell.borrow_const();
+    AdaptiveRef<int> b = cell.borrow_const();
+  }
+  CHECK(cell.stats().samples == 0 && cell.mode() == AdaptiveMode::Parking);
+}
+
+// A thread holding a read borrows again while a writer waits for that read.
+static void nested_while_writer_waits(AdaptiveMode mode) {
+  AdaptivePolicy p;
+  p.sample_every = 0;
+  p.start = mode;
+  AdaptiveCell<int> cell(new int(0), p);
+  AdaptiveRef<int> held = cell.borrow_const();
+  std::atomic<bool> writing{false};
+  std::thread writer([&] {
+    writing = true;
+    *cell.borrow_mut() += 1;
+  });
+  while (!writing.load()) {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));  // writer waits
+  alarm(10);  // a deadlock fails the test
+  {
+    AdaptiveRef<int> again = cell.borrow_const();
+    CHECK(*again == 0);
+  }
+  held.reset();
+  writer.join();
+  alarm(0);
+  CHECK(*cell.borrow_const() == 1);
+}
+
+int main() {
+  switches();
+  cools_down();
+  no_sampling();
+  nested_while_writer_waits(AdaptiveMode::Counter);
+  nested_while_writer_waits(AdaptiveMode::PerCore);
+  nested_while_writer_waits(AdaptiveMode::Parking);
+  exclusion(AdaptiveMode::Counter);
+  exclusion(AdaptiveMode::PerCore);
+  exclusion(AdaptiveMode::Parking);
+  return check_result("test_adaptive");
+}
@@ -0,0 +1,109 @@
+// BufferedCell: publishing, back buffer selection with pinned readers, and
+// readers that never see a back buffer dropped without publish().
+//
+// g++ -std=c++11 -g -O1 -pthread -I.. test_buffered.cc ../borrow_diag.cc -o test_buffered && ./test_buffered
+#include <thread>
+#include <vector>
+#include "../borrow_buffered.h"
+#include "check.h"
+using namespace borrow;
+
+struct Pair {
+  int a;
+  int b;
+};
+
+static void publish() {
+  BufferedCell<int> cell(1);
+  CHECK(*borrow_const(cell) == 1);
+  {
+    RefMut<int> back = cell.borrow_back();
+    CHECK(back);
+    *back = 2;
+    CHECK(*borrow_const(cell) == 1);
+    cell.publish(std::move(back));
+    CHECK(!back);
+  }
+  CHECK(*borrow_const(cell) == 2);
+  CHECK(cell.published() == 1);
+  {
+    RefMut<int> back = cell.borrow_back_copy();
+    CHECK(*back == 2);
+    *back += 1;
+    cell.publish(std::move(back));
+  }
+  CHECK(*borrow_const(cell) == 3);
+  CHECK_ABORTS(cell.publish(RefMut<int>()));
+}
+
+static void pinned() {
+  BufferedCell<int, 2> cell(0);
+  Ref<int> old = borrow_const(cell);
+  RefMut<int> back = cell.borrow_back();
+  *back = 1;
+  cell.publish(std::move(back));
+  // the only other buffer is pinned by `old`
+  CHECK(!cell.borrow_back());
+  CHECK(*old == 0);
+  old.reset();
+  CHECK(static_cast<bool>(cell.borrow_back()));
+}
+
+static void dropped() {
+  BufferedCell<int> cell(1);
+  {
+    RefMut<int> back = cell.borrow_back();
+    *back = -1;  // never published
+  }
+  CHECK(*borrow_const(cell) == 1);
+  for (int i = 0; i < 4; i++) {
+    RefMut<int> back = cell.borrow_back();
+    *back = -1;
+  }
+  CHECK(*borrow_const(cell) == 1);
+}
+
+static void torn() {
+  // the writer alternates published versions {k, k} with back buffers it
+  // abandons half written; readers must only ever see the former
+  BufferedCell<Pair> cell(Pair{0, 0});
+  std::atomic<bool> stop{false};
+  std::atomic<int> bad{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; t++) {
+    readers.emplace_back([&] {
+      while (!stop) {
+        Ref<Pair> r = borrow_const(cell);
+        if (r->a != r->b || r->a < 0) {
+          bad++;
+        }
+      }
+    });
+  }
+  for (int k = 1; k < 200000; k++) {
+    RefMut<Pair> back = cell.borrow_back();
+    if (!back) {
+      continue;
+    }
+    if (k % 2 == 0) {
+      back->a = -k;
+      continue;
+    }
+    back->a = k;
+    back->b = k;
+    cell.publish(std::move(back));
+  }
+  stop = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  CHECK(bad == 0);
+}
+
+int main() {
+  publish();
+  pinned();
+  dropped();
+  torn();
+  return check_result("test_buffered");
+}
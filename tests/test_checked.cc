@@ -0,0 +1,66 @@
+// get_checked(): raw pointers that still verify their borrow in debug
+// builds, and are plain pointers otherwise.
+//
+// g++ -std=c++11 -g -O1 -DBORROW_DEBUG=1 -I.. test_checked.cc ../borrow_diag.cc -o test_checked && ./test_checked
+#include <cstring>
+#include <type_traits>
+#include "../borrow.h"
+#include "check.h"
+using namespace borrow;
+
+#if !BORROW_DEBUG
+static_assert(std::is_same<CheckedPtr<int>, int*>::value, "CheckedPtr must be a plain pointer in release builds");
+#endif
+
+struct Buf {
+  char bytes[8];
+};
+
+static void mut_ptr() {
+  RefCell<Buf> cell(new Buf());
+  CheckedPtr<Buf> p;
+  {
+    RefMut<Buf> m = borrow_mut(cell);
+    p = m.get_checked();
+    memcpy(p->bytes, "abc", 4);  // hot loop / C API use
+    CHECK(strcmp(m->bytes, "abc") == 0);
+    Buf* raw = p;
+    CHECK(raw == &*m);
+  }
+  CHECK_ABORTS((void)*p);
+  cell.reset(new Buf());
+  Ref<Buf> r = borrow_const(cell);
+  CHECK_ABORTS((void)*p);  // only a shared borrow is held now
+}
+
+static void const_ptr() {
+  RefCell<int> cell(new int(4));
+  CheckedPtr<const int> p;
+  {
+    Ref<int> r = borrow_const(cell);
+    p = r.get_checked();
+    int sum = 0;
+    for (int i = 0; i < 3; i++) {
+      sum += *p;
+    }
+    CHECK(sum == 12);
+    Ref<int> other = r;
+    r.reset();
+    CHECK(*p == 4);  // the copy still holds the shared borrow
+  }
+  CHECK_ABORTS((void)*p);
+  RefMut<int> m = borrow_mut(cell);
+  CHECK_ABORTS((void)*p);
+}
+
+static void null_ptr() {
+  CheckedPtr<int> p;
+  CHECK(static_cast<int*>(p) == nullptr);
+}
+
+int main() {
+  mut_ptr();
+  const_ptr();
+  null_ptr();
+  return check_result("test_checked");
+}
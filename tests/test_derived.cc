@@ -0,0 +1,73 @@
+// Derived: lazy and eager invalidation, alone and mixed.
+//
+// g++ -std=c++11 -g -O1 -I.. test_derived.cc ../borrow_diag.cc -o test_derived && ./test_derived
+#include "../borrow_derived.h"
+#include "check.h"
+using namespace borrow;
+
+static void set(VersionedCell<int>& cell, int v) {
+  auto m = cell.borrow_mut();
+  *m = v;
+}
+
+static void single(Invalidation mode) {
+  VersionedCell<int> a(new int(1));
+  VersionedCell<int> b(new int(2));
+  int runs = 0;
+  Derived<int> sum([&](DeriveContext& ctx) {
+    runs++;
+    return *ctx.read(a) + *ctx.read(b);
+  }, mode);
+  CHECK(*sum.get() == 3 && runs == 1);
+  CHECK(*sum.get() == 3 && runs == 1);  // memoized
+  set(a, 10);
+  CHECK(sum.stale());
+  CHECK(*sum.get() == 12 && runs == 2);
+  sum.invalidate();
+  CHECK(*sum.get() == 12 && runs == 3);
+  // recomputing under a live Ref of the old value is a violation
+  Ref<int> held = sum.get();
+  set(b, 5);
+  CHECK_ABORTS(sum.get());
+}
+
+// An input on a DirtySet notifies only when drained; get() must not wait
+// for that.
+static void dirty_input(Invalidation mode) {
+  DirtySet dirty;
+  VersionedCell<int> a(new int(1));
+  a.attach(&dirty);
+  Derived<int> tenfold([&](DeriveContext& ctx) { return *ctx.read(a) * 10; }, mode);
+  CHECK(*tenfold.get() == 10);
+  set(a, 2);
+  CHECK(tenfold.stale());
+  CHECK(*tenfold.get() == 20);
+  dirty.drain();
+  CHECK(*tenfold.get() == 20);
+}
+
+// Every combination of policies for a Derived reading a Derived.
+static void chained(Invalidation inner_mode, Invalidation outer_mode) {
+  VersionedCell<int> a(new int(10));
+  Derived<int> inner([&](DeriveContext& ctx) { return *ctx.read(a) + 20; }, inner_mode);
+  Derived<int> outer([&](DeriveContext& ctx) { return *ctx.read(inner); }, outer_mode);
+  CHECK(*outer.get() == 30);
+  set(a, 50);
+  CHECK(*outer.get() == 70);
+  set(a, 0);
+  CHECK(outer.stale());
+  CHECK(*outer.get() == 20);
+  CHECK(!outer.stale());
+}
+
+int main() {
+  single(Invalidation::Lazy);
+  single(Invalidation::Eager);
+  dirty_input(Invalidation::Lazy);
+  dirty_input(Invalidation::Eager);
+  chained(Invalidation::Lazy, Invalidation::Lazy);
+  chained(Invalidation::Lazy, Invalidation::Eager);
+  chained(Invalidation::Eager, Invalidation::Lazy);
+  chained(Invalidation::Eager, Invalidation::Eager);
+  return check_result("test_derived");
+}
@@ -0,0 +1,73 @@
+// BORROW_GENERATION: resets and moves bump the generation, and guards or
+// checked pointers from before a reset are caught. Built with deferred
+// reporting so that a guard can survive the reset it is checked against.
+//
+// g++ -std=c++11 -g -O1 -DBORROW_GENERATION=1 -DBORROW_DEFERRED_REPORT -I.. test_generation.cc ../borrow_diag.cc -o test_generation && ./test_generation
+#include <cstring>
+#include <utility>
+#include "../borrow.h"
+#include "check.h"
+using namespace borrow;
+
+// Number of queued violations whose message contains `what`.
+static int drain(const char* what) {
+  int n = 0;
+  ViolationRecord rec;
+  while (pop_violation(rec)) {
+    if (strstr(rec.msg, what) != nullptr) {
+      n++;
+    }
+  }
+  return n;
+}
+
+static void bumps() {
+  RefCell<int> cell(new int(1));
+  uint32_t g = cell.gen_;
+  cell.reset(new int(2));
+  CHECK(cell.gen_ == g + 1);
+  cell.reset();
+  CHECK(cell.gen_ == g + 2);
+  cell.reset(new int(3));
+  RefCell<int> moved(std::move(cell));
+  CHECK(moved.gen_ == g + 3);
+  CHECK(cell.gen_ == g + 4);  // guards of the old cell are stale too
+  CHECK(drain("") == 0);
+}
+
+static void stale_guard() {
+  RefCell<int> cell(new int(1));
+  Ref<int> r = borrow_const(cell);
+  CHECK(*r == 1);
+  CHECK(drain("reset") == 0);
+  cell.reset(new int(2));  // reported, but goes ahead
+  CHECK(drain("reset") == 2);
+  (void)*r;
+  CHECK(drain("guard used after its RefCell was reset") == 1);
+  r.reset();
+  Ref<int> fresh = borrow_const(cell);
+  CHECK(*fresh == 2);
+  CHECK(drain("") == 0);
+}
+
+static void stale_checked_ptr() {
+  // the counter check alone can not tell the new borrow from the old one
+  RefCell<int> cell(new int(1));
+  CheckedPtr<const int> p;
+  {
+    Ref<int> r = borrow_const(cell);
+    p = r.get_checked();
+  }
+  cell.reset(new int(2));
+  Ref<int> again = borrow_const(cell);
+  CHECK(drain("") == 0);
+  (void)*p;
+  CHECK(drain("guard used after its RefCell was reset") == 1);
+}
+
+int main() {
+  bumps();
+  stale_guard();
+  stale_checked_ptr();
+  return check_result("test_generation");
+}
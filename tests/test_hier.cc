@@ -0,0 +1,109 @@
+// ChildCell: counted borrows under a shared parent, uncounted access under
+// an ExclusiveCap (also to grandchildren), and proofs from another parent
+// rejected in debug builds.
+//
+// g++ -std=c++11 -g -O1 -DBORROW_DEBUG=1 -I.. test_hier.cc ../borrow_diag.cc -o test_hier && ./test_hier
+#include "../borrow_hier.h"
+#include "check.h"
+using namespace borrow;
+
+struct Inner {
+  ChildCell<int> leaf{new int(3)};
+};
+
+struct Outer {
+  ChildCell<int> a{new int(1)};
+  ChildCell<Inner> inner{new Inner()};
+};
+
+static void shared_parent() {
+  RefCell<Outer> parent(new Outer());
+  Ref<Outer> p = borrow_const(parent);
+  {
+    Ref<int> a = p->a.borrow_const(p);
+    Ref<int> a2 = p->a.borrow_const(p);
+    CHECK(*a == 1);
+    CHECK_ABORTS(p->a.borrow_mut(p));
+  }
+  {
+    RefMut<int> a = p->a.borrow_mut(p);
+    *a = 2;
+    CHECK_ABORTS(p->a.borrow_const(p));
+  }
+  Ref<Inner> in = p->inner.borrow_const(p);
+  CHECK(*in->leaf.borrow_const(in) == 3);
+}
+
+static void exclusive_parent() {
+  RefCell<Outer> parent(new Outer());
+  RefMut<Outer> m = borrow_mut(parent);
+  ExclusiveCap cap(m);
+  *m->a.borrow_mut(cap) = 5;
+  CHECK(*m->a.borrow_const(cap) == 5);
+  // grandchild, reached through the child
+  CheckedPtr<Inner> in = m->inner.borrow_mut(cap);
+  *in->leaf.borrow_mut(cap) = 7;
+  CHECK(*in->leaf.borrow_const(cap) == 7);
+  m->a.reset(cap, new int(6));
+  CHECK(*m->a.borrow_const(cap) == 6);
+}
+
+static void hot_loop() {
+  RefCell<Outer> parent(new Outer());
+  RefMut<Outer> m = borrow_mut(parent);
+  ExclusiveCap cap(m);
+  *m->a.borrow_mut(cap) = 0;
+  // repeated access through the same capability stays linear
+  for (int i = 0; i < 100000; ++i) {
+    ++*m->a.borrow_mut(cap);
+  }
+  for (int i = 0; i < 100000; ++i) {
+    ++*m->inner.borrow_mut(cap)->leaf.borrow_mut(cap);
+  }
+  CHECK(*m->a.borrow_const(cap) == 100000);
+  CHECK(*m->inner.borrow_mut(cap)->leaf.borrow_const(cap) == 100003);
+}
+
+static void wrong_parent() {
+  RefCell<Outer> p1(new Outer());
+  RefCell<Outer> p2(new Outer());
+  {
+    Ref<Outer> r1 = borrow_const(p1);
+    Ref<Outer> r2 = borrow_const(p2);
+    CHECK_ABORTS(r2->a.borrow_const(r1));
+    CHECK_ABORTS(r2->a.borrow_mut(r1));
+    CHECK(*r2->a.borrow_const(r2) == 1);
+  }
+  RefMut<Outer> m1 = borrow_mut(p1);
+  ExclusiveCap cap(m1);
+  {
+    Ref<Outer> r2 = borrow_const(p2);
+    Outer& other = const_cast<Outer&>(*r2);
+    CHECK_ABORTS(other.a.borrow_mut(cap));
+    CHECK_ABORTS(other.a.borrow_const(cap));
+    CHECK_ABORTS(other.a.reset(cap, nullptr));
+    // a grandchild of the other parent is not reachable either
+    Ref<Inner> in = other.inner.borrow_const(r2);
+    CHECK_ABORTS(const_cast<Inner&>(*in).leaf.borrow_mut(cap));
+  }
+}
+
+static void parent_released() {
+  RefCell<Outer> parent(new Outer());
+  CheckedPtr<int> a;
+  {
+    RefMut<Outer> m = borrow_mut(parent);
+    ExclusiveCap cap(m);
+    a = m->a.borrow_mut(cap);
+  }
+  CHECK_ABORTS(*a = 1);
+}
+
+int main() {
+  shared_parent();
+  exclusive_parent();
+  hot_loop();
+  wrong_parent();
+  parent_released();
+  return check_result("test_hier");
+}
@@ -0,0 +1,97 @@
+// MmapCell: writes through the mutable guard reach the file, the mapping's
+// metadata is read-only to borrowers, and reload() picks up a new size.
+//
+// g++ -std=c++11 -g -O1 -I.. test_mmap.cc ../borrow_diag.cc -o test_mmap && ./test_mmap
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include "../borrow_mmap.h"
+#include "check.h"
+using namespace borrow;
+
+static_assert(std::is_same<decltype(std::declval<MmapMut&>().operator->()), const MappedRegion*>::value,
+              "MmapMut must not hand out a mutable MappedRegion");
+
+static int temp_file(const char* contents, char* path) {
+  strcpy(path, "/tmp/borrow-mmap-test.XXXXXX");
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  CHECK(write(fd, contents, strlen(contents)) == static_cast<ssize_t>(strlen(contents)));
+  return fd;
+}
+
+static void shared_write() {
+  char path[64];
+  int fd = temp_file("hello", path);
+  MmapCell cell;
+  CHECK(cell.open(path, MmapMode::Shared, true));
+  CHECK(cell.size() == 5);
+  {
+    MmapMut m = borrow_mut(cell);
+    CHECK(m.size() == 5);
+    CHECK(m->data == m.data());
+    m.data()[0] = 'j';
+    m.mark_dirty(0, 1);
+    CHECK_ABORTS(m.mark_dirty(6, 0));
+    CHECK_ABORTS(m.mark_dirty(1, SIZE_MAX));  // offset + len wraps around
+    CHECK_ABORTS(borrow_const(cell));
+  }
+  {
+    Ref<MappedView> r = borrow_const(cell);
+    CHECK(memcmp(r->data, "jello", 5) == 0);
+    CHECK_ABORTS(borrow_mut(cell));
+  }
+  char buf[5];
+  CHECK(pread(fd, buf, 5, 0) == 5);
+  CHECK(memcmp(buf, "jello", 5) == 0);
+  cell.close();
+  close(fd);
+  unlink(path);
+}
+
+static void read_only() {
+  char path[64];
+  int fd = temp_file("abc", path);
+  MmapCell cell;
+  CHECK(cell.open(path, MmapMode::ReadOnly));
+  CHECK_ABORTS(borrow_mut(cell));
+  Ref<MappedView> r = borrow_const(cell);
+  CHECK(r->size == 3 && r->data[2] == 'c');
+  r.reset();
+  close(fd);
+  unlink(path);
+}
+
+static void reload() {
+  char path[64];
+  int fd = temp_file("abc", path);
+  MmapCell cell;
+  CHECK(cell.open(path, MmapMode::Private));
+  {
+    MmapMut m = borrow_mut(cell);
+    CHECK(write(fd, "defg", 4) == 4);
+    CHECK(cell.reload(m));
+    CHECK(m.size() == 7);
+    CHECK(memcmp(m.data(), "abcdefg", 7) == 0);
+    m.data()[6] = 'x';  // private: stays in this process
+  }
+  char buf[7];
+  CHECK(pread(fd, buf, 7, 0) == 7);
+  CHECK(buf[6] == 'g');
+  MmapCell other;
+  {
+    MmapMut m = borrow_mut(cell);
+    CHECK_ABORTS(other.reload(m));
+  }
+  cell.close();
+  close(fd);
+  unlink(path);
+}
+
+int main() {
+  shared_write();
+  read_only();
+  reload();
+  return check_result("test_mmap");
+}
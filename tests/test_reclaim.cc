@@ -0,0 +1,122 @@
+// ReclaimCell: old values are deleted when their last guard goes away, also
+// while other readers keep borrowing, and guards may outlive the cell.
+//
+// g++ -std=c++11 -g -O1 -pthread -I.. test_reclaim.cc ../borrow_diag.cc -o test_reclaim && ./test_reclaim
+#include <thread>
+#include <vector>
+#include "../borrow_reclaim.h"
+#include "check.h"
+using namespace borrow;
+
+static std::atomic<int> live{0};
+
+struct Value {
+  explicit Value(int v) : v(v) {
+    live++;
+  }
+  ~Value() {
+    live--;
+  }
+  int v;
+};
+
+static void last_guard_deletes() {
+  {
+    ReclaimCell<Value> cell(new Value(1));
+    cell.reset(new Value(2));
+    CHECK(live == 1);  // nobody borrowed the old one
+    ReclaimRef<Value> old = borrow_const(cell);
+    ReclaimRef<Value> old2 = borrow_const(cell);
+    cell.reset(new Value(3));
+    CHECK(live == 2);
+    CHECK(old->v == 2);
+    CHECK(borrow_const(cell)->v == 3);
+    old.reset();
+    CHECK(live == 2);
+    old2.reset();
+    CHECK(live == 1);
+    {
+      ReclaimRefMut<Value> m = borrow_mut(cell);
+      cell.reset(new Value(4));
+      m->v = 30;  // the retired value, still ours
+      CHECK(borrow_const(cell)->v == 4);
+      CHECK(live == 2);
+    }
+    CHECK(live == 1);
+  }
+  CHECK(live == 0);
+}
+
+static void outlives_cell() {
+  ReclaimRef<Value> r;
+  {
+    ReclaimCell<Value> cell(new Value(1));
+    cell.reset(new Value(2));
+    r = borrow_const(cell);
+    cell.reset(new Value(3));
+  }
+  CHECK(live == 1);
+  CHECK(r->v == 2);
+  r.reset();
+  CHECK(live == 0);
+}
+
+static void conflicts() {
+  ReclaimCell<Value> cell(new Value(1));
+  {
+    ReclaimRef<Value> r = borrow_const(cell);
+    CHECK_ABORTS(borrow_mut(cell));
+  }
+  {
+    ReclaimRefMut<Value> m = borrow_mut(cell);
+    CHECK_ABORTS(borrow_const(cell));
+    CHECK_ABORTS(borrow_mut(cell));
+  }
+}
+
+static void busy_readers() {
+  // readers never stop borrowing; old values still go away as soon as the
+  // readers holding them move on
+  const int kReaders = 4;
+  const int kResets = 2000;
+  ReclaimCell<Value> cell(new Value(0));
+  std::atomic<bool> stop{false};
+  std::atomic<int> regress{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < kReaders; t++) {
+    readers.emplace_back([&] {
+      int last = 0;
+      while (!stop) {
+        ReclaimRef<Value> r = borrow_const(cell);
+        if (r->v < last) {
+          regress++;
+        }
+        last = r->v;
+      }
+    });
+  }
+  int max_live = 0;
+  for (int i = 1; i <= kResets; i++) {
+    cell.reset(new Value(i));
+    int n = live;
+    if (n > max_live) {
+      max_live = n;
+    }
+  }
+  CHECK(max_live <= kReaders + 1);
+  stop = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  CHECK(regress == 0);
+  CHECK(live == 1);
+}
+
+int main() {
+  last_guard_deletes();
+  outlives_cell();
+  conflicts();
+  busy_readers();
+  CHECK(live == 0);
+  return check_result("test_reclaim");
+}
@@ -0,0 +1,92 @@
+// BORROW_REGISTRY: borrowed cells show up in the dump with their counter
+// and borrowing thread, slots are reused, cells past the table are counted,
+// and the dump runs from a signal handler.
+//
+// g++ -std=c++11 -g -O1 -DBORROW_REGISTRY -DBORROW_REGISTRY_SIZE=4 -I.. test_registry.cc ../borrow_diag.cc -o test_registry && ./test_registry
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../borrow_registry.h"
+#include "check.h"
+using namespace borrow;
+
+static FILE* out;
+
+static std::string dumped() {
+  std::string s;
+  rewind(out);
+  char buf[256];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), out)) > 0) {
+    s.append(buf, n);
+  }
+  rewind(out);
+  CHECK(ftruncate(fileno(out), 0) == 0);
+  return s;
+}
+
+static bool has(const std::string& s, const std::string& what) {
+  return s.find(what) != std::string::npos;
+}
+
+static std::string hex(const void* p) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%p", p);
+  return buf;
+}
+
+static void listed() {
+  RefCell<int> a(new int(1));
+  RefCell<int> b(new int(2));
+  CHECK(dump_live_cells(fileno(out)) == 0);
+  CHECK(has(dumped(), "borrow: 0 of 2 live cells borrowed, 0 not registered"));
+  Ref<int> r1 = borrow_const(a);
+  Ref<int> r2 = borrow_const(a);
+  RefMut<int> m = borrow_mut(b);
+  CHECK(dump_live_cells(fileno(out)) == 2);
+  std::string s = dumped();
+  CHECK(has(s, "cell " + hex(&a.cnt_) + " cnt 2 thread " + std::to_string(borrow_thread_id())));
+  CHECK(has(s, "cell " + hex(&b.cnt_) + " cnt -1 "));
+  CHECK(has(s, "borrow: 2 of 2 live cells borrowed"));
+}
+
+static void reuse_and_overflow() {
+  {
+    std::vector<std::unique_ptr<RefCell<int>>> cells;
+    for (int i = 0; i < 6; i++) {
+      cells.emplace_back(new RefCell<int>(new int(i)));
+    }
+    CHECK(dump_live_cells(fileno(out)) == 0);
+    CHECK(has(dumped(), "0 of 4 live cells borrowed, 2 not registered"));
+    RefMut<int> m = borrow_mut(*cells[5]);  // unregistered, so not listed
+    CHECK(dump_live_cells(fileno(out)) == 0);
+    dumped();
+  }
+  // slots of destroyed cells are handed out again
+  std::vector<std::unique_ptr<RefCell<int>>> cells;
+  for (int i = 0; i < 4; i++) {
+    cells.emplace_back(new RefCell<int>(new int(i)));
+  }
+  dump_live_cells(fileno(out));
+  CHECK(has(dumped(), "0 of 4 live cells borrowed, 2 not registered"));
+}
+
+static void from_signal() {
+  CHECK(install_registry_signal(SIGUSR1, fileno(out)));
+  RefCell<int> a(new int(1));
+  RefMut<int> m = borrow_mut(a);
+  raise(SIGUSR1);
+  std::string s = dumped();
+  CHECK(has(s, "cell " + hex(&a.cnt_) + " cnt -1"));
+  CHECK(has(s, "1 of 1 live cells borrowed"));
+}
+
+int main() {
+  out = tmpfile();
+  listed();
+  reuse_and_overflow();
+  from_signal();
+  fclose(out);
+  return check_result("test_registry");
+}
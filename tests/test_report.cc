@@ -0,0 +1,112 @@
+// ViolationReporter: records folded into per-site aggregates, the first
+// record of a site printed with its stack, later ones as one count line per
+// pass, and drops reported.
+//
+// g++ -std=c++11 -g -O1 -pthread -DBORROW_DEFERRED_REPORT -DBORROW_VIOLATION_LOG_SIZE=8 -I.. test_report.cc ../borrow_diag.cc -o test_report && ./test_report
+#include <cstring>
+#include <string>
+#include "../borrow_report.h"
+#include "check.h"
+using namespace borrow;
+
+static std::string contents(FILE* f) {
+  std::string s;
+  fflush(f);
+  rewind(f);
+  char buf[256];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    s.append(buf, n);
+  }
+  rewind(f);
+  CHECK(ftruncate(fileno(f), 0) == 0);
+  return s;
+}
+
+static int count(const std::string& s, const char* what) {
+  int n = 0;
+  for (size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + 1)) {
+    n++;
+  }
+  return n;
+}
+
+__attribute__((noinline)) static void site_a(RefCell<int>& cell) {
+  RefMut<int> m = borrow_mut(cell);
+  m.p_cnt_ = nullptr;
+}
+
+__attribute__((noinline)) static void site_b(RefCell<int>& cell) {
+  Ref<int> r = borrow_const(cell);
+  r.p_cnt_ = nullptr;
+}
+
+static void aggregate() {
+  FILE* out = tmpfile();
+  ViolationReporter rep(out);
+  RefCell<int> cell(new int(1));
+  RefMut<int> held = borrow_mut(cell);
+  for (int i = 0; i < 5; i++) {
+    site_a(cell);
+    cell.cnt_ = -1;
+  }
+  site_b(cell);
+  cell.cnt_ = -1;
+  CHECK(rep.drain() == 6);
+  auto sites = rep.sites();
+  CHECK(sites.size() == 2);
+  uint64_t mut_count = 0;
+  uint64_t shared_count = 0;
+  for (auto& kv : sites) {
+    if (kv.second.kind == ViolationKind::MutWhileBorrowed) {
+      mut_count = kv.second.count;
+    } else if (kv.second.kind == ViolationKind::SharedWhileMut) {
+      shared_count = kv.second.count;
+    }
+  }
+  CHECK(mut_count == 5 && shared_count == 1);
+  std::string s = contents(out);
+  CHECK(count(s, "borrow violation (") == 2);  // first record per site, with stack
+  CHECK(count(s, "+4 (total 5)") == 1);        // the rest of site a
+  CHECK(count(s, "(total ") == 1);
+
+  site_a(cell);
+  cell.cnt_ = -1;
+  CHECK(rep.drain() == 1);
+  s = contents(out);
+  CHECK(count(s, "borrow violation (") == 0);
+  CHECK(count(s, "+1 (total 6)") == 1);
+  CHECK(rep.drain() == 0);
+  CHECK(contents(out).empty());
+  fclose(out);
+}
+
+static void dropped() {
+  FILE* out = tmpfile();
+  ViolationReporter rep(out);
+  for (int i = 0; i < 10; i++) {
+    record_violation("test", ViolationKind::Other, nullptr, i);
+  }
+  CHECK(rep.drain() == 8);
+  CHECK(count(contents(out), "dropped 2 records") == 1);
+  fclose(out);
+}
+
+static void thread() {
+  FILE* out = tmpfile();
+  ViolationReporter rep(out, std::chrono::milliseconds(1));
+  rep.start();
+  rep.start();
+  record_violation("from thread", ViolationKind::Other, nullptr, 0);
+  rep.stop();  // final drain
+  rep.stop();
+  CHECK(count(contents(out), "from thread") == 1);
+  fclose(out);
+}
+
+int main() {
+  aggregate();
+  dropped();
+  thread();
+  return check_result("test_report");
+}
@@ -0,0 +1,106 @@
+// SpscRing: FIFO order, full and empty rings, live leases, batched index
+// publication, and a producer/consumer pair on two threads.
+//
+// g++ -std=c++11 -g -O1 -pthread -I.. test_ring.cc ../borrow_diag.cc -o test_ring && ./test_ring
+#include <thread>
+#include "../borrow_ring.h"
+#include "check.h"
+using namespace borrow;
+
+static void fifo() {
+  SpscRing<int, 4> ring;
+  CHECK(!ring.try_consume());
+  for (int i = 0; i < 4; i++) {
+    RefMut<int> m = ring.try_produce();
+    CHECK(m);
+    *m = i;
+  }
+  CHECK(!ring.try_produce());  // full
+  for (int i = 0; i < 4; i++) {
+    Ref<int> r = ring.try_consume();
+    CHECK(r && *r == i);
+  }
+  CHECK(!ring.try_consume());
+  {
+    RefMut<int> m = ring.try_produce();
+    *m = 4;
+  }
+  CHECK(!ring.try_consume());  // the drop is only seen by the next producer call
+  ring.flush_produce();
+  Ref<int> r = ring.try_consume();
+  CHECK(r && *r == 4);
+}
+
+static void live_leases() {
+  SpscRing<int, 4> ring;
+  {
+    RefMut<int> m = ring.try_produce();
+    *m = 1;
+    CHECK_ABORTS(ring.try_produce());
+    CHECK(!ring.try_consume());  // not committed yet
+  }
+  ring.flush_produce();
+  Ref<int> r = ring.try_consume();
+  Ref<int> copy = r;
+  r.reset();
+  CHECK_ABORTS(ring.try_consume());  // the copy keeps the slot leased
+  copy.reset();
+  CHECK(!ring.try_consume());
+}
+
+static void batched() {
+  SpscRing<int, 8> ring(4);
+  for (int i = 0; i < 3; i++) {
+    *ring.try_produce() = i;
+  }
+  CHECK(!ring.try_consume());  // 3 of 4 committed, nothing published
+  *ring.try_produce() = 3;
+  CHECK(!ring.try_consume());
+  *ring.try_produce() = 4;     // commits the 4th, which publishes the batch
+  int n = 0;
+  while (ring.try_consume()) {
+    n++;
+  }
+  CHECK(n == 4);
+  ring.flush_produce();
+  CHECK(ring.try_consume());
+  typedef SpscRing<int, 4> Ring4;
+  CHECK_ABORTS(Ring4(5));
+}
+
+static void two_threads() {
+  const int kItems = 200000;
+  SpscRing<int, 64> ring(8);
+  std::thread producer([&] {
+    for (int i = 0; i < kItems;) {
+      RefMut<int> m = ring.try_produce();
+      if (m) {
+        *m = i++;
+      } else {
+        ring.flush_produce();
+      }
+    }
+    ring.flush_produce();
+  });
+  int next = 0;
+  bool ordered = true;
+  while (next < kItems) {
+    Ref<int> r = ring.try_consume();
+    if (r) {
+      ordered = ordered && *r == next;
+      next++;
+    } else {
+      ring.flush_consume();
+    }
+  }
+  producer.join();
+  CHECK(ordered);
+}
+
+int main() {
+  fifo();
+  live_leases();
+  batched();
+  two_threads();
+  return check_result("test_ring");
+}
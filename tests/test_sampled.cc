@@ -0,0 +1,68 @@
+// BORROW_SAMPLED: sampled conflicts are reported, unsampled ones poison the
+// counter so that the next sampled check on the cell fails.
+//
+// g++ -std=c++11 -g -O1 -DBORROW_SAMPLED -I.. test_sampled.cc ../borrow_diag.cc -o test_sampled && ./test_sampled
+#include "../borrow.h"
+#include "check.h"
+using namespace borrow;
+
+static void every_borrow() {
+  set_sample_rate(1);
+  RefCell<int> cell(new int(1));
+  {
+    Ref<int> r = borrow_const(cell);
+    CHECK_ABORTS(borrow_mut(cell));
+  }
+  {
+    RefMut<int> m = borrow_mut(cell);
+    CHECK_ABORTS(borrow_const(cell));
+  }
+  CHECK(cell.cnt_ == 0);
+}
+
+static void mut_over_reader() {
+  set_sample_rate(0);
+  RefCell<int> cell(new int(1));
+  {
+    Ref<int> r = borrow_const(cell);
+    RefMut<int> m = borrow_mut(cell);  // not reported
+    CHECK(cell.cnt_ < -1);
+  }
+  CHECK(cell.cnt_ < -1);  // the releases do not repair it
+  set_sample_rate(1);
+  CHECK_ABORTS(borrow_mut(cell));
+  CHECK_ABORTS(borrow_const(cell));
+}
+
+static void reader_over_mut() {
+  // -1 + 1 would be 0, a free cell
+  set_sample_rate(0);
+  RefCell<int> cell(new int(1));
+  {
+    RefMut<int> m = borrow_mut(cell);
+    Ref<int> r = borrow_const(cell);
+    CHECK(cell.cnt_ < -1);
+  }
+  set_sample_rate(1);
+  CHECK_ABORTS(borrow_mut(cell));
+}
+
+static void one_in_n() {
+  set_sample_rate(4);
+  RefCell<int> cell(new int(1));
+  int ok = 0;
+  for (int i = 0; i < 8; i++) {
+    Ref<int> r = borrow_const(cell);
+    ok++;
+  }
+  CHECK(ok == 8);
+  CHECK(cell.cnt_ == 0);
+}
+
+int main() {
+  every_borrow();
+  mut_over_reader();
+  reader_over_mut();
+  one_in_n();
+  return check_result("test_sampled");
+}
@@ -0,0 +1,159 @@
+// ShmCell: sharing a value between processes, layout checks on open,
+// recovery from readers and writers that die holding a borrow (also behind
+// a reused PID), and closing with live guards.
+//
+// g++ -std=c++11 -g -O1 -I.. test_shm.cc ../borrow_diag.cc -lrt -o test_shm && ./test_shm
+#include <cstdio>
+#include <sys/wait.h>
+#include "../borrow_shm.h"
+#include "check.h"
+using namespace borrow;
+
+struct Counter {
+  int value;
+  int pad[3];
+};
+
+static char name[64];
+
+// Runs fn in a child process that exits without releasing anything.
+template <class F>
+static void in_child(F fn) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    fn();
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void share() {
+  ShmCell<Counter> cell;
+  CHECK(cell.create(name, Counter{1, {}}));
+  ShmCell<Counter> dup;
+  CHECK(!dup.create(name) && errno == EEXIST);
+  ShmCell<int> wrong;
+  CHECK(!wrong.open(name) && errno == EPROTO);
+  in_child([] {
+    ShmCell<Counter> c;
+    if (!c.open(name)) {
+      _exit(1);
+    }
+    ShmRefMut<Counter> m = c.wait_mut();
+    m->value = 2;
+    m.reset();
+    c.close();
+  });
+  CHECK(cell.borrow_const()->value == 2);
+  {
+    ShmRef<Counter> r = cell.borrow_const();
+    CHECK_ABORTS(cell.borrow_mut());
+  }
+  cell.close();
+  CHECK(ShmCell<Counter>::unlink(name));
+}
+
+static void dead_reader() {
+  ShmCell<Counter> cell;
+  CHECK(cell.create(name, Counter{1, {}}));
+  in_child([] {
+    ShmCell<Counter> c;
+    c.open(name);
+    new ShmRef<Counter>(c.borrow_const());  // never released
+    _exit(0);
+  });
+  CHECK(cell.readers() == 1);
+  {
+    ShmRef<Counter> r = cell.wait_const();  // reads still work next to it
+    CHECK(cell.readers() == 2);
+  }
+  ShmRefMut<Counter> m = cell.wait_mut();  // reaps the dead reader
+  CHECK(m);
+  CHECK(cell.readers() == 0 && cell.header()->cnt_ == -1);
+  m.reset();
+  CHECK(cell.wait_const()->value == 1);
+  cell.close();
+  ShmCell<Counter>::unlink(name);
+}
+
+// Holders recorded under a live PID but another start time are dead
+// processes whose PID was reused.
+static void reused_pid() {
+  ShmCell<Counter> cell;
+  CHECK(cell.create(name, Counter{1, {}}));
+  uint64_t reused = detail::shm_process_id(static_cast<int32_t>(getppid())) ^ (1ULL << 32);
+  ShmHeader* hdr = cell.header();
+  hdr->readers_[5].owner = reused;
+  hdr->readers_[5].count = 3;
+  CHECK(cell.readers() == 3);
+  CHECK(cell.wait_mut());
+  CHECK(cell.readers() == 0 && hdr->readers_[5].owner == 0);
+
+  hdr->owner_ = reused;
+  hdr->cnt_ = -1;
+  CHECK(!cell.wait_const());
+  CHECK(cell.poisoned());
+  CHECK(cell.recover());
+  cell.close();
+  ShmCell<Counter>::unlink(name);
+}
+
+static void close_borrowed() {
+  ShmCell<Counter> cell;
+  CHECK(cell.create(name, Counter{1, {}}));
+  CHECK_ABORTS({
+    ShmRef<Counter> r = cell.borrow_const();
+    cell.close();
+  });
+  CHECK_ABORTS({
+    ShmRefMut<Counter> m = cell.borrow_mut();
+    cell.close();
+  });
+  {
+    ShmRef<Counter> r = cell.borrow_const();
+  }
+  cell.close();
+  ShmCell<Counter>::unlink(name);
+}
+
+static void dead_writer() {
+  ShmCell<Counter> cell;
+  CHECK(cell.create(name, Counter{1, {}}));
+  uint32_t gen = cell.generation();
+  in_child([] {
+    ShmCell<Counter> c;
+    c.open(name);
+    ShmRefMut<Counter>* m = new ShmRefMut<Counter>(c.borrow_mut());
+    (*m)->value = -1;  // half done
+    _exit(0);
+  });
+  CHECK(cell.generation() == gen + 1);
+  CHECK(!cell.wait_const());  // notices the dead writer, poisons
+  CHECK(cell.poisoned());
+  CHECK(!cell.wait_mut());
+  CHECK_ABORTS(cell.borrow_const());
+  {
+    ShmRefMut<Counter> m = cell.recover();
+    CHECK(m);
+    CHECK(!cell.poisoned());
+    CHECK(!cell.recover());
+    CHECK(m->value == -1);
+    m->value = 1;
+  }
+  CHECK(cell.wait_const()->value == 1);
+  cell.close();
+  ShmCell<Counter>::unlink(name);
+}
+
+int main() {
+  snprintf(name, sizeof(name), "/borrow-shm-test.%d", static_cast<int>(getpid()));
+  share();
+  dead_reader();
+  dead_writer();
+  reused_pid();
+  close_borrowed();
+  return check_result("test_shm");
+}
@@ -0,0 +1,79 @@
+// BORROW_TRACE: a session's records, error counting, and cells of several
+// processes kept apart when their files are merged.
+//
+// g++ -std=c++11 -g -O1 -DBORROW_TRACE -I.. test_trace.cc ../borrow_diag.cc -o test_trace && ./test_trace
+#include "../borrow.h"
+#include "../tools/borrow_trace_files.h"
+#include "check.h"
+#include <cstdlib>
+using namespace borrow;
+
+static void records() {
+  char dir[] = "/tmp/borrow-trace-test.XXXXXX";
+  CHECK(mkdtemp(dir) != nullptr);
+  uint64_t errors = trace_errors();
+  RefCell<int> cell(new int(1));
+  trace_start(dir);
+  {
+    Ref<int> r = borrow_const(cell);
+  }
+  {
+    RefMut<int> m = borrow_mut(cell);
+  }
+  trace_stop();
+  trace_close_thread();
+  CHECK(trace_errors() == errors);
+
+  std::vector<TraceFile> files;
+  add_trace_path(dir, files);
+  CHECK(files.size() == 1);
+  if (files.size() == 1) {
+    CHECK(files[0].hdr->count == 4);  // two borrows, two releases
+    CHECK(files[0].n == 4);
+    CHECK(files[0].hdr->pid == static_cast<uint32_t>(getpid()));
+    CHECK(files[0].recs[0].op == TraceOp::Shared);
+    CHECK(files[0].recs[2].op == TraceOp::Mut);
+    CHECK(files[0].recs[0].cell == files[0].recs[2].cell);
+    unlink(files[0].path.c_str());
+  }
+  rmdir(dir);
+}
+
+static void missing_dir() {
+  uint64_t errors = trace_errors();
+  RefCell<int> cell(new int(1));
+  trace_start("/nonexistent/borrow-trace");
+  {
+    Ref<int> r = borrow_const(cell);
+  }
+  trace_stop();
+  trace_close_thread();
+  CHECK(trace_errors() == errors + 1);
+}
+
+static void pids() {
+  // the same address in two processes is two cells
+  TraceFileHeader h1{}, h2{};
+  h1.pid = 10;
+  h2.pid = 20;
+  TraceRecord r1{}, r2{};
+  r1.cell = r2.cell = 0x1000;
+  r1.ts_ns = 1;
+  r2.ts_ns = 2;
+  std::vector<TraceFile> files;
+  files.push_back(TraceFile{"a", &h1, &r1, 1});
+  files.push_back(TraceFile{"b", &h2, &r2, 1});
+  std::vector<MergedRecord> recs = merge_trace(files);
+  CHECK(recs.size() == 2);
+  if (recs.size() == 2) {
+    CHECK(recs[0].pid == 10 && recs[1].pid == 20);
+    CHECK(!(recs[0].key() == recs[1].key()));
+  }
+}
+
+int main() {
+  records();
+  missing_dir();
+  pids();
+  return check_result("test_trace");
+}
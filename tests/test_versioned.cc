@@ -0,0 +1,110 @@
+// VersionedCell: versions, dirty sets, and subscribers that touch their
+// own cell.
+//
+// g++ -std=c++11 -g -O1 -I.. test_versioned.cc ../borrow_diag.cc -o test_versioned && ./test_versioned
+#include "../borrow_versioned.h"
+#include "check.h"
+using namespace borrow;
+
+static void versions() {
+  VersionedCell<int> cell(new int(1));
+  CHECK(cell.version() == 0);
+  {
+    auto r = cell.borrow_const();
+    CHECK(cell.version() == 0);
+    CHECK_ABORTS(cell.borrow_mut());
+  }
+  {
+    auto m = cell.borrow_mut();
+    *m = 2;
+    CHECK(cell.version() == 0);  // published on release
+  }
+  CHECK(cell.version() == 1);
+  cell.reset(new int(3));
+  CHECK(cell.version() == 2 && *cell.borrow_const() == 3);
+}
+
+static void dirty_set() {
+  DirtySet set;
+  VersionedCell<int> a(new int(0));
+  VersionedCell<int> b(new int(0));
+  a.attach(&set);
+  b.attach(&set);
+  int notified = 0;
+  a.subscribe([&](VersionedBase&) { notified++; });
+  for (int i = 0; i < 3; i++) {
+    *a.borrow_mut() += 1;
+  }
+  *b.borrow_mut() += 1;
+  CHECK(notified == 0);  // batched until the drain
+  size_t seen = 0;
+  CHECK(set.drain([&](VersionedBase&) { seen++; }) == 2);
+  CHECK(seen == 2 && notified == 1 && set.empty());
+}
+
+// Subscribers run with no lock held: they may borrow, subscribe and
+// unsubscribe on the cell that notified them.
+static void reentrant_subscribers() {
+  VersionedCell<int> cell(new int(0));
+  int self_runs = 0;
+  int late_runs = 0;
+  size_t self_id = 0;
+  self_id = cell.subscribe([&](VersionedBase&) {
+    self_runs++;
+    CHECK(*cell.borrow_const() >= 1);
+    cell.unsubscribe(self_id);
+    cell.subscribe([&](VersionedBase&) { late_runs++; });
+  });
+  int mut_runs = 0;
+  cell.subscribe([&](VersionedBase&) {
+    if (mut_runs++ == 0) {
+      *cell.borrow_mut() += 100;  // notifies again, once
+    }
+  });
+  *cell.borrow_mut() += 1;
+  CHECK(*cell.borrow_const() == 101);
+  CHECK(self_runs == 1);
+  CHECK(mut_runs == 2);
+  CHECK(late_runs == 1);
+}
+
+// A second unsubscribe with an old id leaves later subscribers alone.
+static void ids_unique() {
+  VersionedCell<int> cell(new int(0));
+  size_t old = cell.subscribe([](VersionedBase&) {});
+  cell.unsubscribe(old);
+  int runs = 0;
+  size_t id = cell.subscribe([&](VersionedBase&) { runs++; });
+  CHECK(id != old);
+  cell.unsubscribe(old);
+  *cell.borrow_mut() += 1;
+  CHECK(runs == 1);
+  cell.unsubscribe(id);
+  *cell.borrow_mut() += 1;
+  CHECK(runs == 1);
+}
+
+static void destroyed_dirty() {
+  DirtySet set;
+  {
+    VersionedCell<int> cell(new int(0));
+    cell.attach(&set);
+    *cell.borrow_mut() += 1;
+    set.drain();
+  }
+  CHECK(set.empty());
+  CHECK_ABORTS({
+    VersionedCell<int> cell(new int(0));
+    cell.attach(&set);
+    *cell.borrow_mut() += 1;
+  });
+}
+
+int main() {
+  versions();
+  dirty_set();
+  reentrant_subscribers();
+  ids_unique();
+  destroyed_dirty();
+  return check_result("test_versioned");
+}
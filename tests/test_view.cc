@@ -0,0 +1,84 @@
+// ViewBorrow: views share one borrow of the buffer, keep refills out, are
+// bounds checked (also against overflowing offset + length), and in debug
+// builds may not outlive their ViewBorrow.
+//
+// g++ -std=c++17 -g -O1 -DBORROW_DEBUG=1 -I.. test_view.cc ../borrow_diag.cc -o test_view && ./test_view
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../borrow_view.h"
+#include "check.h"
+using namespace borrow;
+
+static void parse() {
+  RefCell<std::string> buf(new std::string("key=value;a=b"));
+  std::vector<BorrowedStringView> fields;
+  {
+    ViewBorrow<std::string> vb(buf);
+    BorrowedStringView all = vb.view();
+    size_t start = 0;
+    for (size_t i = 0; i <= all.size(); i++) {
+      if (i == all.size() || all[i] == ';') {
+        fields.push_back(all.substr(start, i - start));
+        start = i + 1;
+      }
+    }
+    CHECK(fields.size() == 2);
+    CHECK(fields[0] == "key=value");
+    CHECK(fields[1].substr(2) == "b");
+    CHECK(buf.cnt_ == 1);  // one borrow for all views
+    CHECK_ABORTS(borrow_mut(buf));
+    fields.clear();
+  }
+  CHECK(buf.cnt_ == 0);
+  *borrow_mut(buf) = "refilled";
+}
+
+static void spans() {
+  RefCell<std::vector<uint32_t>> buf(new std::vector<uint32_t>{1, 2, 3, 4});
+  ViewBorrow<std::vector<uint32_t>> vb(buf);
+  BorrowedSpan<uint32_t> s = vb.span(1, 3);
+  CHECK(s.size() == 3 && s[0] == 2);
+  BorrowedSpan<uint32_t> t = s.subspan(1, 2);
+  uint32_t sum = 0;
+  for (uint32_t v : t) {
+    sum += v;
+  }
+  CHECK(sum == 7);
+  CHECK(s.subspan(3, 0).empty());
+  CHECK_ABORTS(s.subspan(2, 2));
+  CHECK_ABORTS(s.subspan(1, SIZE_MAX));
+  CHECK_ABORTS(vb.span(5, 0));
+}
+
+static void bounds() {
+  RefCell<std::string> buf(new std::string("abc"));
+  ViewBorrow<std::string> vb(buf);
+  CHECK(vb.view(3, 0).empty());
+  CHECK_ABORTS(vb.view(2, 2));
+  CHECK_ABORTS(vb.view(1, SIZE_MAX));
+  CHECK_ABORTS(vb.view(4, 0));
+}
+
+static void outlived() {
+  RefCell<std::string> buf(new std::string("abc"));
+  CHECK_ABORTS({
+    BorrowedStringView v;
+    {
+      ViewBorrow<std::string> vb(buf);
+      v = vb.view();
+    }
+  });
+  Ref<std::string> r = borrow_const(buf);
+  CHECK_ABORTS(ViewBorrow<std::string>(Ref<std::string>()));
+  ViewBorrow<std::string> vb(std::move(r));
+  CHECK(vb.view(1, 1) == "b");
+}
+
+int main() {
+  parse();
+  spans();
+  bounds();
+  outlived();
+  return check_result("test_view");
+}
@@ -0,0 +1,174 @@
+// Offline analyzer for BORROW_TRACE files (see borrow_trace.h).
+//
+// Maps every trace file given (or every borrow-trace.* file in the given
+// directories), merges the records by timestamp and replays the borrows per
+// cell. It reports, for the busiest cells:
+//  - acquisitions, and handoffs: acquisitions whose previous user of the
+//    cell was another thread, i.e. the counter's cache line moved;
+//  - conflicts: acquisitions while another thread held the cell in a
+//    conflicting mode (a violation for RefCell, a wait for thread-safe
+//    cells);
+//  - reader fan-out (shared holders at a shared acquisition, mean and max);
+//  - hold times of shared and mutable borrows (p50/p99/max, log2 buckets);
+// and the site pairs (acquiring site, holder's site) that conflicted most.
+// Cells are printed as pid:address. Sites are PCs; symbolize them with
+// addr2line.
+//
+// g++ -std=c++11 -O2 borrow_trace_analyze.cc -o borrow_trace_analyze
+// ./borrow_trace_analyze [-n top] <dir or file>...
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "borrow_trace_files.h"
+using namespace borrow;
+
+struct Holder {
+  uint32_t tid;
+  bool mut;
+  uint64_t site;
+  uint64_t since;
+};
+
+struct CellStats {
+  uint64_t shared = 0;
+  uint64_t mut = 0;
+  uint64_t handoffs = 0;
+  uint64_t conflicts = 0;
+  uint64_t fanout_sum = 0;
+  uint64_t fanout_max = 0;
+  uint64_t unmatched = 0;  // releases without a traced acquisition
+  uint32_t last_tid = 0;
+  LogHistogram hold_shared;
+  LogHistogram hold_mut;
+  std::vector<Holder> holders;
+};
+
+static void print_hist(const char* name, const LogHistogram& h) {
+  if (h.count == 0) {
+    printf("      %-6s -\n", name);
+    return;
+  }
+  printf("      %-6s n=%" PRIu64 " p50<=%" PRIu64 "ns p99<=%" PRIu64 "ns max=%" PRIu64 "ns\n", name, h.count,
+         h.quantile(0.5), h.quantile(0.99), h.max);
+}
+
+int main(int argc, char** argv) {
+  size_t top = 10;
+  std::vector<TraceFile> files;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      top = static_cast<size_t>(atoi(argv[++i]));
+    } else {
+      add_trace_path(argv[i], files);
+    }
+  }
+  if (files.empty()) {
+    fprintf(stderr, "usage: %s [-n top] <trace dir or file>...\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<MergedRecord> recs = merge_trace(files);
+
+  std::unordered_map<CellKey, CellStats, CellKeyHash> cells;
+  std::map<std::pair<uint64_t, uint64_t>, uint64_t> conflict_sites;
+  for (const MergedRecord& m : recs) {
+    const TraceRecord* r = m.rec;
+    CellStats& c = cells[m.key()];
+    bool mut = r->op == TraceOp::Mut || r->op == TraceOp::MutRelease;
+    if (r->op == TraceOp::Shared || r->op == TraceOp::Mut) {
+      (mut ? c.mut : c.shared)++;
+      if (c.last_tid != 0 && c.last_tid != r->tid) {
+        c.handoffs++;
+      }
+      c.last_tid = r->tid;
+      size_t readers = 1;
+      for (auto& h : c.holders) {
+        if (h.tid != r->tid && (mut || h.mut)) {
+          c.conflicts++;
+          conflict_sites[std::make_pair(r->site, h.site)]++;
+        }
+        readers += h.mut ? 0 : 1;
+      }
+      if (!mut) {
+        c.fanout_sum += readers;
+        c.fanout_max = std::max<uint64_t>(c.fanout_max, readers);
+      }
+      c.holders.push_back(Holder{r->tid, mut, r->site, r->ts_ns});
+    } else if (r->op == TraceOp::SharedRelease || r->op == TraceOp::MutRelease) {
+      // latest matching acquisition of this thread, else of any thread (a
+      // guard moved to another thread)
+      int found = -1;
+      for (int i = static_cast<int>(c.holders.size()) - 1; i >= 0; i--) {
+        if (c.holders[i].mut == mut && (c.holders[i].tid == r->tid || found < 0)) {
+          found = i;
+          if (c.holders[i].tid == r->tid) {
+            break;
+          }
+        }
+      }
+      if (found < 0) {
+        c.unmatched++;
+        continue;
+      }
+      uint64_t held = r->ts_ns - c.holders[found].since;
+      (mut ? c.hold_mut : c.hold_shared).add(held);
+      c.holders.erase(c.holders.begin() + found);
+    }
+  }
+
+  uint64_t first = recs.empty() ? 0 : recs.front().rec->ts_ns;
+  uint64_t last = recs.empty() ? 0 : recs.back().rec->ts_ns;
+  printf("%zu files, %zu records, %zu cells, %.3f ms\n", files.size(), recs.size(), cells.size(),
+         (last - first) / 1e6);
+
+  std::vector<std::pair<CellKey, const CellStats*>> order;
+  for (auto& kv : cells) {
+    order.push_back(std::make_pair(kv.first, &kv.second));
+  }
+  std::sort(order.begin(), order.end(), [](const std::pair<CellKey, const CellStats*>& a,
+                                           const std::pair<CellKey, const CellStats*>& b) {
+    if (a.second->conflicts != b.second->conflicts) {
+      return a.second->conflicts > b.second->conflicts;
+    }
+    if (a.second->handoffs != b.second->handoffs) {
+      return a.second->handoffs > b.second->handoffs;
+    }
+    return a.second->shared + a.second->mut > b.second->shared + b.second->mut;
+  });
+  printf("\ncells by conflicts, handoffs, acquisitions:\n");
+  for (size_t i = 0; i < order.size() && i < top; i++) {
+    const CellStats& c = *order[i].second;
+    printf("  cell %u:0x%" PRIx64 ": shared %" PRIu64 " mut %" PRIu64 " handoffs %" PRIu64 " conflicts %" PRIu64
+           " fan-out mean %.2f max %" PRIu64,
+           order[i].first.pid, order[i].first.cell, c.shared, c.mut, c.handoffs, c.conflicts,
+           c.shared == 0 ? 0.0 : static_cast<double>(c.fanout_sum) / c.shared, c.fanout_max);
+    if (c.unmatched != 0 || !c.holders.empty()) {
+      printf(" (%" PRIu64 " unmatched releases, %zu still held)", c.unmatched, c.holders.size());
+    }
+    printf("\n");
+    print_hist("shared", c.hold_shared);
+    print_hist("mut", c.hold_mut);
+  }
+
+  std::vector<std::pair<std::pair<uint64_t, uint64_t>, uint64_t>> pairs(conflict_sites.begin(),
+                                                                       conflict_sites.end());
+  std::sort(pairs.begin(), pairs.end(), [](const std::pair<std::pair<uint64_t, uint64_t>, uint64_t>& a,
+                                           const std::pair<std::pair<uint64_t, uint64_t>, uint64_t>& b) {
+    return a.second > b.second;
+  });
+  printf("\nconflicting site pairs (acquired at, while held from):\n");
+  if (pairs.empty()) {
+    printf("  none\n");
+  }
+  for (size_t i = 0; i < pairs.size() && i < top; i++) {
+    printf("  %" PRIu64 "x 0x%" PRIx64 " <- 0x%" PRIx64 "\n", pairs[i].second, pairs[i].first.first,
+           pairs[i].first.second);
+  }
+  return 0;
+}
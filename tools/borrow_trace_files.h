@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../borrow_trace.h"
+namespace borrow {
+
+// Read side of the BORROW_TRACE file format, shared by the trace tools.
+// Files are mapped read-only and never unmapped.
+
+struct TraceFile {
+  std::string path;
+  const TraceFileHeader* hdr;
+  const TraceRecord* recs;
+  size_t n;
+};
+
+inline bool map_trace_file(const std::string& path, std::vector<TraceFile>& out) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror(path.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TraceFileHeader)) {
+    fprintf(stderr, "%s: too short\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path.c_str());
+    return false;
+  }
+  const TraceFileHeader* hdr = static_cast<const TraceFileHeader*>(p);
+  if (memcmp(hdr->magic, kTraceMagic, sizeof(hdr->magic)) != 0 || hdr->version != kTraceVersion ||
+      hdr->record_size != sizeof(TraceRecord)) {
+    fprintf(stderr, "%s: not a borrow trace (or another version)\n", path.c_str());
+    munmap(p, st.st_size);
+    return false;
+  }
+  TraceFile f;
+  f.path = path;
+  f.hdr = hdr;
+  f.recs = reinterpret_cast<const TraceRecord*>(hdr + 1);
+  size_t max = (st.st_size - sizeof(TraceFileHeader)) / sizeof(TraceRecord);
+  f.n = hdr->count != 0 && hdr->count <= max ? hdr->count : max;
+  // not closed cleanly: the zero-filled tail ends the records
+  while (f.n > 0 && f.recs[f.n - 1].op == TraceOp::None) {
+    f.n--;
+  }
+  out.push_back(f);
+  return true;
+}
+
+inline void add_trace_path(const std::string& path, std::vector<TraceFile>& out) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    perror(path.c_str());
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    map_trace_file(path, out);
+    return;
+  }
+  DIR* d = opendir(path.c_str());
+  if (d == nullptr) {
+    perror(path.c_str());
+    return;
+  }
+  std::vector<std::string> names;
+  while (dirent* e = readdir(d)) {
+    if (strncmp(e->d_name, "borrow-trace.", 13) == 0) {
+      names.push_back(path + "/" + e->d_name);
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  for (auto& n : names) {
+    map_trace_file(n, out);
+  }
+}
+
+// A cell of a traced process. Cells are identified by address, so traces
+// of several processes need the pid as well.
+struct CellKey {
+  uint32_t pid;
+  uint64_t cell;
+  bool operator==(const CellKey& o) const {
+    return pid == o.pid && cell == o.cell;
+  }
+};
+
+struct CellKeyHash {
+  size_t operator()(const CellKey& k) const {
+    return std::hash<uint64_t>()(k.cell * 31 + k.pid);
+  }
+};
+
+struct MergedRecord {
+  const TraceRecord* rec;
+  uint32_t pid;
+  CellKey key() const {
+    return CellKey{pid, rec->cell};
+  }
+};
+
+// Records of all files, ordered by timestamp (ties keep file order).
+inline std::vector<MergedRecord> merge_trace(const std::vector<TraceFile>& files) {
+  std::vector<MergedRecord> recs;
+  for (auto& f : files) {
+    for (size_t i = 0; i < f.n; i++) {
+      recs.push_back(MergedRecord{&f.recs[i], f.hdr->pid});
+    }
+  }
+  std::stable_sort(recs.begin(), recs.end(),
+                   [](const MergedRecord& a, const MergedRecord& b) { return a.rec->ts_ns < b.rec->ts_ns; });
+  return recs;
+}
+
+// log2 buckets of nanoseconds
+struct LogHistogram {
+  uint64_t buckets[64] = {};
+  uint64_t count = 0;
+  uint64_t max = 0;
+
+  void add(uint64_t ns) {
+    buckets[ns == 0 ? 0 : 64 - __builtin_clzll(ns)]++;
+    count++;
+    max = std::max(max, ns);
+  }
+  void merge(const LogHistogram& o) {
+    for (int i = 0; i < 64; i++) {
+      buckets[i] += o.buckets[i];
+    }
+    count += o.count;
+    max = std::max(max, o.max);
+  }
+  // upper bound of the bucket holding quantile q
+  uint64_t quantile(double q) const {
+    uint64_t want = static_cast<uint64_t>(q * count);
+    uint64_t seen = 0;
+    for (int i = 0; i < 64; i++) {
+      seen += buckets[i];
+      if (seen > want) {
+        return i == 0 ? 0 : (i >= 63 ? UINT64_MAX : (1ull << i));
+      }
+    }
+    return max;
+  }
+};
+
+} // namespace borrow
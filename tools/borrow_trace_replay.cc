@@ -0,0 +1,408 @@
+// Replays a BORROW_TRACE recording against several cell protocols and
+// reports throughput and acquisition latency for each, so the variant for a
+// cell can be picked from a production trace instead of a microbenchmark.
+//
+// Every trace file becomes one replay thread that issues its thread's
+// borrows and releases in order. The recorded gap before each event (think
+// time, or hold time before a release) is reproduced by spinning, scaled by
+// -s (0 replays back to back, i.e. maximum contention). Variants:
+//  - counter: one atomic counter per cell (RefCell protocol, waiting)
+//  - percore: readers in per-CPU slots, writers drain them
+//  - seqlock: readers write nothing and retry (re-spinning their hold time)
+//    when a writer ran meanwhile
+//  - rcu: readers never wait; a writer publishes on release and waits for
+//    the readers that started before it
+// An acquisition that can not succeed within -t ms (a conflict the recorded
+// program got away with, e.g. under BORROW_DEFERRED_REPORT) is counted as a
+// timeout and replayed as not held.
+//
+// g++ -std=c++17 -O2 -pthread borrow_trace_replay.cc -o borrow_trace_replay
+// ./borrow_trace_replay [-s scale] [-t timeout_ms] [-v counter,percore,seqlock,rcu] <dir or file>...
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sched.h>
+#include "borrow_trace_files.h"
+using namespace borrow;
+using borrow::detail::trace_now_ns;
+
+struct Event {
+  uint64_t delay_ns;  // since the thread's previous event
+  uint32_t cell;
+  TraceOp op;
+};
+
+struct ThreadTrace {
+  std::vector<Event> events;
+};
+
+struct alignas(64) Padded {  // one cache line
+  std::atomic<int64_t> v{0};
+};
+
+static const size_t kSlots = 16;
+
+// acquire() returns a token for release(), or -1 on timeout; release()
+// returns false when a reader has to retry. Both give up waiting after
+// deadline.
+class Variant {
+ public:
+  virtual ~Variant() = default;
+  virtual int64_t acquire(uint32_t cell, bool mut, size_t thread, uint64_t deadline) = 0;
+  virtual bool release(uint32_t cell, bool mut, size_t thread, int64_t token, uint64_t deadline) = 0;
+};
+
+class CounterVariant : public Variant {
+ public:
+  CounterVariant(size_t cells, size_t) : cnt_(cells) {
+  }
+  int64_t acquire(uint32_t cell, bool mut, size_t, uint64_t deadline) override {
+    std::atomic<int64_t>& c = cnt_[cell].v;
+    for (;;) {
+      int64_t v = c.load();
+      if (mut ? v == 0 : v >= 0) {
+        if (c.compare_exchange_weak(v, mut ? -1 : v + 1)) {
+          return 0;
+        }
+        continue;
+      }
+      if (trace_now_ns() > deadline) {
+        return -1;
+      }
+      sched_yield();
+    }
+  }
+  bool release(uint32_t cell, bool mut, size_t, int64_t, uint64_t) override {
+    if (mut) {
+      cnt_[cell].v.store(0);
+    } else {
+      cnt_[cell].v--;
+    }
+    return true;
+  }
+
+ private:
+  std::vector<Padded> cnt_;
+};
+
+class PerCoreVariant : public Variant {
+ public:
+  PerCoreVariant(size_t cells, size_t) : writer_(cells), slots_(cells * kSlots) {
+  }
+  int64_t acquire(uint32_t cell, bool mut, size_t, uint64_t deadline) override {
+    std::atomic<int64_t>& w = writer_[cell].v;
+    if (mut) {
+      int64_t expected = 0;
+      while (!w.compare_exchange_weak(expected, 1)) {
+        expected = 0;
+        if (trace_now_ns() > deadline) {
+          return -1;
+        }
+        sched_yield();
+      }
+      for (size_t i = 0; i < kSlots; i++) {
+        while (slots_[cell * kSlots + i].v.load() != 0) {
+          if (trace_now_ns() > deadline) {
+            w.store(0);
+            return -1;
+          }
+          sched_yield();
+        }
+      }
+      return 0;
+    }
+    size_t slot = static_cast<unsigned>(sched_getcpu()) % kSlots;
+    std::atomic<int64_t>& s = slots_[cell * kSlots + slot].v;
+    for (;;) {
+      s++;
+      if (w.load() == 0) {
+        return static_cast<int64_t>(slot);
+      }
+      s--;
+      if (trace_now_ns() > deadline) {
+        return -1;
+      }
+      sched_yield();
+    }
+  }
+  bool release(uint32_t cell, bool mut, size_t, int64_t token, uint64_t) override {
+    if (mut) {
+      writer_[cell].v.store(0);
+    } else {
+      slots_[cell * kSlots + token].v--;
+    }
+    return true;
+  }
+
+ private:
+  std::vector<Padded> writer_;
+  std::vector<Padded> slots_;
+};
+
+class SeqlockVariant : public Variant {
+ public:
+  SeqlockVariant(size_t cells, size_t) : seq_(cells) {
+  }
+  int64_t acquire(uint32_t cell, bool mut, size_t, uint64_t deadline) override {
+    std::atomic<int64_t>& s = seq_[cell].v;
+    for (;;) {
+      int64_t v = s.load(std::memory_order_acquire);
+      if (v % 2 == 0 && (!mut || s.compare_exchange_weak(v, v + 1))) {
+        return v;
+      }
+      if (trace_now_ns() > deadline) {
+        return -1;
+      }
+      sched_yield();
+    }
+  }
+  bool release(uint32_t cell, bool mut, size_t, int64_t token, uint64_t) override {
+    std::atomic<int64_t>& s = seq_[cell].v;
+    if (mut) {
+      s.store(token + 2, std::memory_order_release);
+      return true;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return s.load(std::memory_order_relaxed) == token;
+  }
+
+ private:
+  std::vector<Padded> seq_;
+};
+
+class RcuVariant : public Variant {
+ public:
+  RcuVariant(size_t cells, size_t threads)
+      : threads_(threads), writer_(cells), epoch_(cells), readers_(cells * threads), depth_(cells * threads) {
+    for (auto& e : epoch_) {
+      e.v.store(1);
+    }
+  }
+  int64_t acquire(uint32_t cell, bool mut, size_t thread, uint64_t deadline) override {
+    if (!mut) {
+      // readers only announce the epoch they started in
+      if (depth_[cell * threads_ + thread]++ == 0) {
+        readers_[cell * threads_ + thread].v.store(epoch_[cell].v.load());
+      }
+      return 0;
+    }
+    int64_t expected = 0;
+    while (!writer_[cell].v.compare_exchange_weak(expected, 1)) {
+      expected = 0;
+      if (trace_now_ns() > deadline) {
+        return -1;
+      }
+      sched_yield();
+    }
+    return 0;
+  }
+  bool release(uint32_t cell, bool mut, size_t thread, int64_t, uint64_t deadline) override {
+    if (!mut) {
+      if (--depth_[cell * threads_ + thread] == 0) {
+        readers_[cell * threads_ + thread].v.store(0);
+      }
+      return true;
+    }
+    // publish the new version, then wait for a grace period
+    int64_t e = epoch_[cell].v.fetch_add(1) + 1;
+    for (size_t t = 0; t < threads_; t++) {
+      if (t == thread) {
+        continue;
+      }
+      std::atomic<int64_t>& r = readers_[cell * threads_ + t].v;
+      for (;;) {
+        int64_t v = r.load();
+        if (v == 0 || v >= e || trace_now_ns() > deadline) {
+          break;
+        }
+        sched_yield();
+      }
+    }
+    writer_[cell].v.store(0);
+    return true;
+  }
+
+ private:
+  size_t threads_;
+  std::vector<Padded> writer_;
+  std::vector<Padded> epoch_;
+  std::vector<Padded> readers_;
+  std::vector<uint32_t> depth_;  // only touched by the owning thread
+};
+
+static std::unique_ptr<Variant> make_variant(const std::string& name, size_t cells, size_t threads) {
+  if (name == "counter") {
+    return std::unique_ptr<Variant>(new CounterVariant(cells, threads));
+  }
+  if (name == "percore") {
+    return std::unique_ptr<Variant>(new PerCoreVariant(cells, threads));
+  }
+  if (name == "seqlock") {
+    return std::unique_ptr<Variant>(new SeqlockVariant(cells, threads));
+  }
+  if (name == "rcu") {
+    return std::unique_ptr<Variant>(new RcuVariant(cells, threads));
+  }
+  return nullptr;
+}
+
+struct ThreadResult {
+  LogHistogram latency;
+  uint64_t acquisitions = 0;
+  uint64_t timeouts = 0;
+  uint64_t retries = 0;
+};
+
+static void spin_until(uint64_t t) {
+  while (trace_now_ns() < t) {
+  }
+}
+
+struct Held {
+  uint32_t cell;
+  bool mut;
+  int64_t token;  // -1: timed out, not held
+  uint64_t since;
+};
+
+static void replay_thread(const ThreadTrace& trace, size_t thread, Variant& v, double scale, uint64_t timeout_ns,
+                          uint64_t start, ThreadResult& res) {
+  std::vector<Held> held;
+  uint64_t t = start;
+  for (const Event& e : trace.events) {
+    t += static_cast<uint64_t>(e.delay_ns * scale);
+    spin_until(t);
+    bool mut = e.op == TraceOp::Mut || e.op == TraceOp::MutRelease;
+    if (e.op == TraceOp::Shared || e.op == TraceOp::Mut) {
+      uint64_t t0 = trace_now_ns();
+      int64_t token = v.acquire(e.cell, mut, thread, t0 + timeout_ns);
+      uint64_t t1 = trace_now_ns();
+      res.latency.add(t1 - t0);
+      res.acquisitions++;
+      res.timeouts += token < 0 ? 1 : 0;
+      held.push_back(Held{e.cell, mut, token, t1});
+      t = std::max(t, t1);
+    } else if (e.op == TraceOp::SharedRelease || e.op == TraceOp::MutRelease) {
+      int found = -1;
+      for (int i = static_cast<int>(held.size()) - 1; i >= 0 && found < 0; i--) {
+        if (held[i].cell == e.cell && held[i].mut == mut) {
+          found = i;
+        }
+      }
+      if (found < 0) {
+        continue;  // acquired before the trace started, or on another thread
+      }
+      Held h = held[found];
+      held.erase(held.begin() + found);
+      if (h.token < 0) {
+        continue;
+      }
+      while (!v.release(h.cell, h.mut, thread, h.token, trace_now_ns() + timeout_ns)) {
+        // seqlock reader saw a writer: do the read again
+        res.retries++;
+        uint64_t hold = trace_now_ns() - h.since;
+        h.since = trace_now_ns();
+        h.token = v.acquire(h.cell, h.mut, thread, h.since + timeout_ns);
+        if (h.token < 0) {
+          res.timeouts++;
+          break;
+        }
+        spin_until(h.since + hold);
+      }
+      t = std::max(t, trace_now_ns());
+    }
+  }
+  for (auto& h : held) {
+    if (h.token >= 0) {
+      v.release(h.cell, h.mut, thread, h.token, trace_now_ns() + timeout_ns);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  double scale = 1.0;
+  uint64_t timeout_ns = 100 * 1000000ull;
+  std::string variants = "counter,percore,seqlock,rcu";
+  std::vector<TraceFile> files;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      scale = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      timeout_ns = static_cast<uint64_t>(atof(argv[++i]) * 1e6);
+    } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+      variants = argv[++i];
+    } else {
+      add_trace_path(argv[i], files);
+    }
+  }
+  if (files.empty()) {
+    fprintf(stderr, "usage: %s [-s scale] [-t timeout_ms] [-v variants] <trace dir or file>...\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t first = UINT64_MAX;
+  for (auto& f : files) {
+    if (f.n > 0) {
+      first = std::min(first, f.recs[0].ts_ns);
+    }
+  }
+  std::unordered_map<CellKey, uint32_t, CellKeyHash> cell_ids;
+  std::vector<ThreadTrace> traces(files.size());
+  uint64_t events = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    uint64_t prev = first;
+    for (size_t j = 0; j < files[i].n; j++) {
+      const TraceRecord& r = files[i].recs[j];
+      CellKey key{files[i].hdr->pid, r.cell};
+      auto it = cell_ids.emplace(key, static_cast<uint32_t>(cell_ids.size())).first;
+      traces[i].events.push_back(Event{r.ts_ns - prev, it->second, r.op});
+      prev = r.ts_ns;
+      events++;
+    }
+  }
+  printf("%zu threads, %zu cells, %" PRIu64 " events, time scale %.2f\n", traces.size(), cell_ids.size(), events,
+         scale);
+  printf("%-8s %10s %12s %10s %10s %10s %9s %8s\n", "variant", "wall ms", "acq/s", "p50 ns", "p99 ns", "max ns",
+         "timeouts", "retries");
+
+  size_t pos = 0;
+  while (pos <= variants.size()) {
+    size_t comma = variants.find(',', pos);
+    std::string name = variants.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+    pos = comma == std::string::npos ? variants.size() + 1 : comma + 1;
+    std::unique_ptr<Variant> v = make_variant(name, cell_ids.size(), traces.size());
+    if (!v) {
+      fprintf(stderr, "unknown variant %s\n", name.c_str());
+      continue;
+    }
+    std::vector<ThreadResult> results(traces.size());
+    std::vector<std::thread> threads;
+    uint64_t start = trace_now_ns() + 10000000;  // let every thread get going
+    for (size_t i = 0; i < traces.size(); i++) {
+      threads.emplace_back(replay_thread, std::cref(traces[i]), i, std::ref(*v), scale, timeout_ns, start,
+                           std::ref(results[i]));
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    uint64_t wall = trace_now_ns() - start;
+    ThreadResult total;
+    for (auto& r : results) {
+      total.latency.merge(r.latency);
+      total.acquisitions += r.acquisitions;
+      total.timeouts += r.timeouts;
+      total.retries += r.retries;
+    }
+    printf("%-8s %10.2f %12.0f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %9" PRIu64 " %8" PRIu64 "\n", name.c_str(),
+           wall / 1e6, total.acquisitions / (wall / 1e9), total.latency.quantile(0.5), total.latency.quantile(0.99),
+           total.latency.max, total.timeouts, total.retries);
+  }
+  return 0;
+}